@@ -9,6 +9,17 @@
 //    - Top 16 rows are always orange
 //    - Bottom 48 rows are always blue
 //    - Width = 128
+//    - The I2C bus speed can be changed with I2C_CLOCK. The time it takes to
+//      send each frame (and the best possible frame rate) is printed to
+//      Serial (115200 baud) every 100 frames.
+//    - BALL_COUNT sets how many balls bounce around. The time it takes to
+//      move and draw all of them is printed to Serial as well.
+//    - The ball is drawn once with fillCircle() at startup and kept as a set
+//      of pixel columns, which are then copied straight into the screen buffer
+//      for every ball. Set USE_CIRCLE_CACHE to false to compare the speed.
+//    - The balls move at a fixed rate (one step every 20 ms), no matter how
+//      long drawing takes. If a frame is late, the balls catch up and the
+//      missed frames are skipped instead of slowing everything down.
 // 
 //------------------------------------------------------------------------------
 
@@ -22,61 +33,274 @@
 #define SCREEN_ADDRESS 0x3C   // The I2C address of the display
 #define OLED_SDA 14           // Correct SDA pin for your wiring (D6 on most boards)
 #define OLED_SCL 12           // Correct SCL pin for your wiring (D5 on most boards)
+#define I2C_CLOCK 400000      // I2C bus speed: 100000 (standard), 400000 (fast), 800000 (experimental)
 
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
+// Use the same (fast) I2C speed while sending frames and in between
+// (the Adafruit library sends up to a full Wire buffer per I2C transfer)
+Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET, I2C_CLOCK, I2C_CLOCK);
 
 // Setup for ball motion
-int x_pos =  4;          // Runs from 0 to 128 (minus half the ball_radius)
-int y_pos = 20;          // Runs from 8 to  64 (minus half the ball_radius)  
-int ball_radius = 4;     // Size of the ball
-int x_motion = 2;        // Motion in the x direction
-int y_motion = 3;        // Motion in the y direction
-
-
-// Function to update the position of the ball with each loop
-void update_ball_position() {
-    // Update position
-    x_pos += x_motion;
-    y_pos += y_motion;
-
-    // Check left-right boundaries
-    if ((x_pos - ball_radius) <= 0 || (x_pos + ball_radius) >= 128) {
-        x_motion *= -1;  // Reverse x direction
+// Positions and motions are "fixed-point" numbers: the value is multiplied by 256
+// (FIXED_ONE), so the balls can move by fractions of a pixel without using floats.
+// Each value has its own array, so the update loop runs through memory in order.
+#define BALL_COUNT 10            // Number of balls (try a few hundred to test the speed)
+#define FIXED_SHIFT 8
+#define FIXED_ONE (1 << FIXED_SHIFT)
+const int ball_radius = 4;       // Size of the balls
+int32_t ball_x[BALL_COUNT];      // Runs from 0 to 128 (minus the ball_radius)
+int32_t ball_y[BALL_COUNT];      // Runs from 16 to 64 (minus the ball_radius)
+int32_t ball_x_motion[BALL_COUNT];   // Motion in the x direction (per step)
+int32_t ball_y_motion[BALL_COUNT];   // Motion in the y direction (per step)
+
+// Pre-drawn ball
+#define USE_CIRCLE_CACHE true     // Copy the pre-drawn ball instead of calling fillCircle()
+#define MAX_BALL_RADIUS 12        // Largest ball that fits in the cache (25 pixels across)
+uint32_t ball_columns[2 * MAX_BALL_RADIUS + 1];   // One bit per pixel, top pixel = bit 0
+static_assert(ball_radius <= MAX_BALL_RADIUS, "ball_radius is too big for the pre-drawn ball");
+
+// Setup for the game loop
+#define STEP_MS 20                // Move the balls once every 20 ms (50 steps per second)
+#define MAX_STEPS_PER_FRAME 5     // If we fall further behind than this, give up catching up
+unsigned long last_loop_time = 0; // When loop() last ran (in milliseconds)
+unsigned long step_time_ms = 0;   // Time waiting to be turned into ball steps
+unsigned long last_frame_time = 0;   // When the last frame was drawn
+int fps = 0;                      // Frames per second (shown at the top of the screen)
+
+// Frame-time benchmark
+unsigned long flush_time_total_us = 0;   // Time spent in display.display() (microseconds)
+unsigned long flush_time_max_us = 0;     // Slowest display.display() so far
+int benchmark_frames = 0;                // Frames measured since the last report
+unsigned long benchmark_start = 0;       // When the current report period started
+unsigned long skipped_frames = 0;        // Ball steps that were never drawn
+unsigned long update_time_total_us = 0;  // Time spent moving the balls
+unsigned long draw_time_total_us = 0;    // Time spent drawing into the screen buffer
+#define HISTOGRAM_BUCKETS 8              // Frame times in 5 ms buckets (the last one is 35 ms or more)
+#define HISTOGRAM_BUCKET_MS 5
+unsigned long frame_time_histogram[HISTOGRAM_BUCKETS];
+
+
+// Function to give every ball its starting position and motion
+void setup_balls() {
+    // The first ball starts like the original single-ball demo
+    ball_x[0] = 4 * FIXED_ONE;
+    ball_y[0] = 20 * FIXED_ONE;
+    ball_x_motion[0] = 2 * FIXED_ONE;
+    ball_y_motion[0] = 3 * FIXED_ONE;
+
+    // The rest start at random places with random speeds (0.5 to 3 pixels per step)
+    for (int i = 1; i < BALL_COUNT; i++) {
+        ball_x[i] = random(ball_radius + 1, 128 - ball_radius) * FIXED_ONE;
+        ball_y[i] = random(16 + ball_radius + 1, 64 - ball_radius - ball_radius/2) * FIXED_ONE;
+        ball_x_motion[i] = random(FIXED_ONE / 2, 3 * FIXED_ONE) * (random(2) ? 1 : -1);
+        ball_y_motion[i] = random(FIXED_ONE / 2, 3 * FIXED_ONE) * (random(2) ? 1 : -1);
+    }
+}
+
+
+// Function to draw the ball once with Adafruit_GFX and keep its pixels, column by column
+void build_ball_cache() {
+    display.clearDisplay();
+    display.fillCircle(ball_radius, ball_radius, ball_radius, WHITE);
+
+    // The screen buffer holds 8 rows of pixels per byte (one "page"), lowest bit on top
+    uint8_t* buffer = display.getBuffer();
+    for (int column = 0; column <= 2 * ball_radius; column++) {
+        uint32_t bits = 0;
+        for (int row = 0; row <= 2 * ball_radius; row++) {
+            if (buffer[(row / 8) * SCREEN_WIDTH + column] & (1 << (row % 8))) {
+                bits |= (uint32_t)1 << row;
+            }
+        }
+        ball_columns[column] = bits;
+    }
+    display.clearDisplay();
+}
+
+
+// Function to copy the pre-drawn ball into the screen buffer, a byte at a time
+void draw_cached_ball(int x_center, int y_center) {
+    uint8_t* buffer = display.getBuffer();
+    int left = x_center - ball_radius;
+    int top = y_center - ball_radius;
+
+    for (int column = 0; column <= 2 * ball_radius; column++) {
+        int x = left + column;
+        if (x < 0 || x >= SCREEN_WIDTH) continue;
+
+        // Line the column up with the page it starts in, then OR it in page by page
+        uint32_t bits = ball_columns[column];
+        int page;
+        if (top < 0) {
+            bits >>= -top;
+            page = 0;
+        } else {
+            bits <<= top % 8;
+            page = top / 8;
+        }
+        while (bits && page < SCREEN_HEIGHT / 8) {
+            buffer[page * SCREEN_WIDTH + x] |= bits & 0xFF;
+            bits >>= 8;
+            page++;
+        }
+    }
+}
+
+
+// Function to update the position of all the balls with each step
+void update_ball_positions() {
+    // The boundaries, worked out once for all the balls
+    const int32_t left   = ball_radius * FIXED_ONE;
+    const int32_t right  = (128 - ball_radius) * FIXED_ONE;
+    const int32_t top    = (16 + ball_radius) * FIXED_ONE;   // Avoiding top 16 rows of orange pixels
+    const int32_t bottom = (64 - ball_radius - ball_radius/2) * FIXED_ONE;
+
+    // Update positions
+    for (int i = 0; i < BALL_COUNT; i++) {
+        ball_x[i] += ball_x_motion[i];
+        ball_y[i] += ball_y_motion[i];
     }
 
-    // Check top-bottom boundaries   (avoiding top 16 rows of orange pixels)
-    if ((y_pos - ball_radius) <= 16 || (y_pos + ball_radius + (ball_radius/2)) >= 64) {
-        y_motion *= -1;  // Reverse y direction
+    // Check left-right boundaries (only bounce if moving towards the wall)
+    for (int i = 0; i < BALL_COUNT; i++) {
+        if ((ball_x[i] <= left && ball_x_motion[i] < 0) || (ball_x[i] >= right && ball_x_motion[i] > 0)) {
+            ball_x_motion[i] = -ball_x_motion[i];   // Reverse x direction
+        }
+    }
+
+    // Check top-bottom boundaries
+    for (int i = 0; i < BALL_COUNT; i++) {
+        if ((ball_y[i] <= top && ball_y_motion[i] < 0) || (ball_y[i] >= bottom && ball_y_motion[i] > 0)) {
+            ball_y_motion[i] = -ball_y_motion[i];   // Reverse y direction
+        }
     }
 }
 
 
-// Function to draw the text at the top (in the orange area) and the ball (in the blue area)
+// Function to draw the text at the top (in the orange area) and the balls (in the blue area)
 void draw_to_the_screen(){
+    unsigned long draw_start = micros();
     display.clearDisplay();
 
     // Display position information in the top orange area
     display.setTextSize(1);
     display.setCursor(0,0);
     display.setTextColor(SSD1306_WHITE);       // It'll be orange no matter what you put here
-    display.printf ("X = %3d      Y = %3d\n", x_pos, y_pos);   // Write the pos into to screen
+    display.printf ("X=%3d  Y=%3d  %2d FPS\n",   // Write the pos of the first ball to the screen
+                    (int)(ball_x[0] >> FIXED_SHIFT), (int)(ball_y[0] >> FIXED_SHIFT), fps);
     display.println("____________________");   // Just makes it look nice, like a top wall
 
-    // Draw the ball (a filled circle) -- color will be blue no matter what
-    display.fillCircle(x_pos, y_pos, ball_radius, WHITE);
+    // Draw the balls (filled circles) -- color will be blue no matter what
+    for (int i = 0; i < BALL_COUNT; i++) {
+        if (USE_CIRCLE_CACHE) {
+            draw_cached_ball(ball_x[i] >> FIXED_SHIFT, ball_y[i] >> FIXED_SHIFT);
+        } else {
+            display.fillCircle(ball_x[i] >> FIXED_SHIFT, ball_y[i] >> FIXED_SHIFT, ball_radius, WHITE);
+        }
+    }
+    draw_time_total_us += micros() - draw_start;
 
+    // Send the frame to the display (and time how long it takes)
+    unsigned long flush_start = micros();
     display.display();
+    unsigned long flush_time_us = micros() - flush_start;
+
+    flush_time_total_us += flush_time_us;
+    if (flush_time_us > flush_time_max_us) flush_time_max_us = flush_time_us;
+    benchmark_frames++;
+}
+
+
+// Add the time between this frame and the last one to the histogram
+void record_frame_time(unsigned long now){
+    unsigned long frame_time_ms = now - last_frame_time;
+    last_frame_time = now;
+
+    int bucket = frame_time_ms / HISTOGRAM_BUCKET_MS;
+    if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+    frame_time_histogram[bucket]++;
+}
+
+
+// Print the frame-time benchmark to Serial every 100 frames
+void report_frame_time(){
+    if (benchmark_frames < 100) return;
+
+    unsigned long now = millis();
+    fps = benchmark_frames * 1000UL / (now - benchmark_start);
+
+    unsigned long average_us = flush_time_total_us / benchmark_frames;
+    Serial.printf("I2C %lu Hz: display() takes %lu us (max %lu us), up to %lu FPS\n",
+                  (unsigned long)I2C_CLOCK, average_us, flush_time_max_us, 1000000UL / average_us);
+    Serial.printf("Running at %d FPS, %lu skipped frames so far\n", fps, skipped_frames);
+    Serial.printf("%d balls: moving takes %lu us per step, drawing takes %lu us per frame (circle cache %s)\n",
+                  BALL_COUNT, update_time_total_us / benchmark_frames, draw_time_total_us / benchmark_frames,
+                  USE_CIRCLE_CACHE ? "on" : "off");
+
+    Serial.print("Frame times:");
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (i == HISTOGRAM_BUCKETS - 1) {   // The last bucket also counts everything slower
+            Serial.printf(" %d+ms:%lu", i * HISTOGRAM_BUCKET_MS, frame_time_histogram[i]);
+        } else {
+            Serial.printf(" %d-%dms:%lu", i * HISTOGRAM_BUCKET_MS, (i + 1) * HISTOGRAM_BUCKET_MS, frame_time_histogram[i]);
+        }
+        frame_time_histogram[i] = 0;
+    }
+    Serial.println();
+
+    flush_time_total_us = 0;
+    flush_time_max_us = 0;
+    update_time_total_us = 0;
+    draw_time_total_us = 0;
+    benchmark_frames = 0;
+    benchmark_start = now;
 }
 
 
 void setup() {
+    Serial.begin(115200);
     Wire.begin(OLED_SDA, OLED_SCL);
+    Wire.setClock(I2C_CLOCK);
     display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS);
+
+    randomSeed(micros());
+    setup_balls();
+    build_ball_cache();
+
+    last_loop_time = millis();
+    last_frame_time = last_loop_time;
+    benchmark_start = last_loop_time;
 }
 
 
 void loop() {
-    update_ball_position();
-    draw_to_the_screen();
-    delay(20);   // Add a small delay to make the movement visible
+    // Add up the time that has passed since the last loop
+    unsigned long now = millis();
+    step_time_ms += now - last_loop_time;
+    last_loop_time = now;
+
+    // Move the balls once for every 20 ms that has passed
+    int steps = 0;
+    unsigned long update_start = micros();
+    while (step_time_ms >= STEP_MS && steps < MAX_STEPS_PER_FRAME) {
+        update_ball_positions();
+        step_time_ms -= STEP_MS;
+        steps++;
+    }
+    if (steps > 0) {
+        update_time_total_us += (micros() - update_start) / steps;
+    }
+    if (step_time_ms >= STEP_MS) {
+        step_time_ms = 0;   // Still a whole step behind after the last allowed step, so drop the rest
+    }
+
+    // Only draw when the balls moved. If it moved more than once, the frames
+    // in between were skipped so the balls keep their speed.
+    if (steps > 0) {
+        skipped_frames += steps - 1;
+        draw_to_the_screen();
+        record_frame_time(now);
+        report_frame_time();
+    } else {
+        delay(1);   // Nothing to do yet
+    }
 }
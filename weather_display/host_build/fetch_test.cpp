@@ -0,0 +1,403 @@
+//------------------------------------------------------------------------------------
+// Weather Display: tests of the fetch code against a mock server
+//
+// Runs the sketch's fetch_and_display_weather() over real connections to
+// mock_server.py, once for every way a fetch can go (a good reply, "304 Not
+// Modified", server and request errors, bad or cut off JSON, refused connections,
+// timeouts, a body that is too big or too slow, ...), and checks that each one
+// ends up in the right branch. A fetch that worked must have stored the values
+// that are in the payload. Every case is run several times, and the time each
+// fetch took is reported as a distribution (percentiles).
+//
+// The sketch decides between HTTP and HTTPS (USE_HTTPS), so CMake builds this twice:
+// fetch_test (the sketch as it is, HTTPS) and fetch_test_http (plain HTTP).
+//
+//    fetch_test [options]
+//      --runs N         Runs of each case (default 20; the slow timeout cases run once)
+//      --only TEXT      Only run the cases with TEXT in their name
+//      --quick          Skip the cases that wait for a timeout (about 20 s)
+//      --csv FILE       Write one line per fetch to FILE
+//      --serial         Show the sketch's Serial output
+//
+// The exit code is 1 if any fetch didn't end the way it should.
+//------------------------------------------------------------------------------------
+#include "host_hal.h"
+#include "host_socket.h"
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The sketch itself, so its fetch code and statistics can be used directly
+#include WEATHER_SKETCH
+
+#define CERTIFICATE_FILE "mock_server_cert.pem"   // Made by mock_server.py (in the current folder)
+
+// What a case needs besides the mock server's options
+#define CASE_SLOW 0x01            // Waits for a timeout, so it only runs once
+#define CASE_TLS_ONLY 0x02        // Only makes sense with HTTPS
+#define CASE_NO_SERVER 0x04       // Nothing listens on the port
+#define CASE_NOT_MODIFIED 0x08    // The first fetch gets the data, the others "304 Not Modified"
+#define CASE_PIN 0x10             // Set the fingerprint of the mock server's certificate
+#define CASE_WRONG_PIN 0x20       // Set a fingerprint that doesn't match
+
+struct FetchCase {
+    const char* name;
+    const char* server_options;   // For mock_server.py
+    FailureKind expected;
+    const char* stop_reason;      // Why the body reader should stop (nullptr: don't check)
+    uint8_t flags;
+};
+
+const FetchCase fetch_cases[] = {
+    { "ok",                     "",                                      FAILURE_NONE,       nullptr,         0 },
+    { "ok, slow server",        "--latency 20 --jitter 80",              FAILURE_NONE,       nullptr,         0 },
+    { "ok, two locations",      "--payload two_locations.json",          FAILURE_NONE,       nullptr,         0 },
+    { "ok, chunked",            "--chunked 100",                         FAILURE_NONE,       nullptr,         0 },
+    { "ok, throttled",          "--throttle 8000",                       FAILURE_NONE,       nullptr,         0 },
+    { "not modified",           "--etag",                                FAILURE_NONE,       nullptr,         CASE_NOT_MODIFIED },
+    { "server busy (503)",      "--status 503",                          FAILURE_SERVER,     nullptr,         0 },
+    { "server error (500)",     "--status 500",                          FAILURE_SERVER,     nullptr,         0 },
+    { "rate limited (429)",     "--status 429",                          FAILURE_SERVER,     nullptr,         0 },
+    { "bad request (400)",      "--status 400",                          FAILURE_REQUEST,    nullptr,         0 },
+    { "not found (404)",        "--status 404",                          FAILURE_REQUEST,    nullptr,         0 },
+    { "login page, not JSON",   "--payload login_page.html",             FAILURE_DATA,       nullptr,         0 },
+    { "truncated body",         "--truncate 500",                        FAILURE_DATA,       "end of body",   0 },
+    { "truncated chunked body", "--chunked 100 --truncate 500",          FAILURE_DATA,       "end of body",   0 },
+    { "second location cut off", "--payload two_locations.json --truncate 1500",
+                                LOCATION_COUNT > 1 ? FAILURE_DATA : FAILURE_NONE, nullptr, 0 },
+    { "body too big",           "--pad 20000",                           FAILURE_DATA,       "size limit",    0 },
+    { "connection refused",     nullptr,                                 FAILURE_CONNECTION, nullptr,         CASE_NO_SERVER },
+    { "pinned certificate",     "",                                      FAILURE_NONE,       nullptr,         CASE_TLS_ONLY | CASE_PIN },
+    { "wrong certificate",      "",                                      FAILURE_CONNECTION, nullptr,         CASE_TLS_ONLY | CASE_WRONG_PIN },
+    { "no answer",              "--stall",                               FAILURE_CONNECTION, nullptr,         CASE_SLOW },
+    { "body stalls",            "--stall-after 300",                     FAILURE_DATA,       "idle timeout",  CASE_SLOW },
+    { "body too slow",          "--throttle 60",                         FAILURE_DATA,       "total timeout", CASE_SLOW },
+};
+
+// What the sketch should store from payloads/one_location.json (also the first
+// location of two_locations.json): tenths, with the wind speed in m/s. Wind direction
+// and precipitation aren't requested, so they stay 0.
+const WeatherSample payload_weather    = { 185, 172, 710, 10090, 40, 0, 910, 0 };
+const WeatherSample payload_first_hour = { 183, 171, 720, 10093, 38, 0, 900, 0 };
+#define PAYLOAD_TIME 1792026900           // "current" "time"
+#define PAYLOAD_FORECAST_START 1792026000 // The first "hourly" "time"
+#define PAYLOAD_FORECAST_HOURS 6          // Hours in "hourly"
+
+// One fetch
+struct FetchRun {
+    FailureKind result;
+    unsigned long fetch_ms;       // The whole fetch (what the sketch measured)
+    unsigned long headers_ms;     // Until the headers had arrived (incl. connecting and TLS)
+    unsigned long first_byte_ms;  // Until the first body byte
+    size_t bytes;
+    std::string stop_reason;
+    bool resumed;                 // The TLS session was resumed
+    bool weather_changed;         // The weather, forecast or API time changed
+};
+
+static pid_t server_pid = 0;
+
+
+// Start mock_server.py with these options, and return its port (0 if it didn't start)
+static uint16_t start_mock_server(const char* options){
+    std::vector<std::string> arguments = { PYTHON, MOCK_SERVER };
+    if (USE_HTTPS) {
+        arguments.push_back("--tls");
+        arguments.push_back(CERTIFICATE_FILE);
+    }
+    std::string option;
+    for (const char* c = options;; c++) {
+        if (*c == ' ' || *c == '\0') {
+            if (!option.empty()) arguments.push_back(option);
+            option.clear();
+            if (*c == '\0') break;
+        } else {
+            option += *c;
+        }
+    }
+
+    int output[2];
+    if (pipe(output) != 0) return 0;
+    fflush(stdout);
+    server_pid = fork();
+    if (server_pid == 0) {
+        dup2(output[1], STDOUT_FILENO);
+        close(output[0]);
+        close(output[1]);
+        std::vector<char*> argv;
+        for (std::string& argument : arguments) argv.push_back(&argument[0]);
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        perror(argv[0]);
+        _exit(127);
+    }
+    close(output[1]);
+
+    // The server prints its port once it is ready
+    FILE* server_output = fdopen(output[0], "r");
+    char line[32] = "";
+    bool ok = server_pid > 0 && fgets(line, sizeof(line), server_output) != nullptr;
+    fclose(server_output);
+    return ok ? atoi(line) : 0;
+}
+
+
+static void stop_mock_server(){
+    if (server_pid <= 0) return;
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, nullptr, 0);
+    server_pid = 0;
+}
+
+
+// A port nothing listens on
+static uint16_t unused_port(){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(fd, (struct sockaddr*)&address, sizeof(address));
+    getsockname(fd, (struct sockaddr*)&address, &length);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+
+// The SHA-1 fingerprint of the mock server's certificate, as "AB:CD:..."
+static std::string certificate_fingerprint(){
+    FILE* command = popen("openssl x509 -noout -fingerprint -sha1 -in " CERTIFICATE_FILE, "r");
+    if (command == nullptr) return "";
+    char line[128] = "";
+    if (fgets(line, sizeof(line), command) == nullptr) line[0] = '\0';
+    pclose(command);
+    const char* equals = strchr(line, '=');   // "SHA1 Fingerprint=AB:CD:..."
+    std::string fingerprint = equals ? equals + 1 : "";
+    while (!fingerprint.empty() && isspace((unsigned char)fingerprint.back())) fingerprint.pop_back();
+    return fingerprint;
+}
+
+
+static FetchRun run_fetch(){
+    bytes_parsed = 0;   // Only set when a body was read
+    first_byte_ms = 0;
+    body_stop_reason = "";
+    unsigned long resumed_before = host_socket_stats.tls_resumed;
+    WeatherSample weather_before[LOCATION_COUNT];
+    WeatherSample forecast_before[LOCATION_COUNT][FORECAST_HOURS];
+    memcpy(weather_before, location_weather, sizeof(weather_before));
+    memcpy(forecast_before, forecast, sizeof(forecast_before));
+    uint32_t api_time_before = api_time;
+
+    FetchRun run;
+    run.result = fetch_and_display_weather();
+    run.fetch_ms = http_ms;
+    run.headers_ms = tls_request_ms;
+    run.first_byte_ms = first_byte_ms;
+    run.bytes = bytes_parsed;
+    run.stop_reason = body_stop_reason;
+    run.resumed = host_socket_stats.tls_resumed != resumed_before;
+    run.weather_changed = memcmp(weather_before, location_weather, sizeof(weather_before)) != 0
+                       || memcmp(forecast_before, forecast, sizeof(forecast_before)) != 0
+                       || api_time != api_time_before;
+    return run;
+}
+
+
+// Did the last fetch store what is in the payload? Returns "" if it did.
+static std::string check_payload_values(){
+    if (memcmp(&location_weather[0], &payload_weather, sizeof(payload_weather)) != 0) {
+        return "stored the wrong weather";
+    }
+    if (api_time != PAYLOAD_TIME) {
+        return "stored the wrong time";
+    }
+    if (USE_FORECAST && (forecast_count != min(PAYLOAD_FORECAST_HOURS, FORECAST_HOURS)
+                         || forecast_start != PAYLOAD_FORECAST_START
+                         || memcmp(&forecast[0][0], &payload_first_hour, sizeof(payload_first_hour)) != 0)) {
+        return "stored the wrong forecast";
+    }
+    return "";
+}
+
+
+// The value below which this fraction of the (sorted) values lies
+static unsigned long percentile(const std::vector<unsigned long>& sorted, double fraction){
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)ceil(fraction * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+
+// Run one case. Returns the number of fetches that went wrong.
+static int run_case(const FetchCase& test, int runs, FILE* csv){
+    static std::string fingerprint;
+    int failed = 0;
+
+    if (test.flags & CASE_NO_SERVER) {
+        host_socket.port = unused_port();
+    } else {
+        host_socket.port = start_mock_server(test.server_options);
+        if (host_socket.port == 0) {
+            printf("%-24s  the mock server didn't start\n", test.name);
+            stop_mock_server();
+            return 1;
+        }
+    }
+    if (test.flags & CASE_PIN) {
+        fingerprint = certificate_fingerprint();
+        server_fingerprint = fingerprint.c_str();
+    } else if (test.flags & CASE_WRONG_PIN) {
+        server_fingerprint = "00 11 22 33 44 55 66 77 88 99 AA BB CC DD EE FF 00 11 22 33";
+    } else {
+        server_fingerprint = "";
+    }
+    rtc_data.etag[0] = '\0';   // Every case starts without a saved ETag
+    rtc_data.last_modified[0] = '\0';
+    memset(location_weather, 0, sizeof(location_weather));   // ... and without weather, so any change shows
+    memset(forecast, 0, sizeof(forecast));
+    forecast_count = 0;
+    api_time = 0;
+
+    std::vector<unsigned long> fetch_times;
+    std::vector<unsigned long> header_times;
+    for (int i = 0; i < runs; i++) {
+        unsigned long full_before = full_fetches;
+        unsigned long not_modified_before = not_modified_fetches;
+        FetchRun run = run_fetch();
+        fetch_times.push_back(run.fetch_ms);
+        if (run.headers_ms > 0) header_times.push_back(run.headers_ms);
+
+        // Did it end the way it should?
+        std::string problem;
+        std::string wrong_values = run.result == FAILURE_NONE ? check_payload_values() : "";
+        if (run.result != test.expected) {
+            problem = std::string("ended as \"") + retry_policies[run.result].name + "\"";
+        } else if (test.stop_reason && run.stop_reason != test.stop_reason) {
+            problem = "stopped reading because of \"" + run.stop_reason + "\"";
+        } else if ((test.flags & CASE_NOT_MODIFIED) && i == 0 && full_fetches == full_before) {
+            problem = "didn't get the data";
+        } else if ((test.flags & CASE_NOT_MODIFIED) && i > 0 && not_modified_fetches == not_modified_before) {
+            problem = "didn't get \"304 Not Modified\"";
+        } else if (run.result != FAILURE_NONE && run.weather_changed) {
+            problem = "changed the weather";   // Only a complete reply may do that
+        } else if (!wrong_values.empty()) {
+            problem = wrong_values;
+        } else if (USE_HTTPS && test.expected != FAILURE_CONNECTION && run.resumed != (i > 0)) {
+            // A new server doesn't know the saved session, after that it is resumed
+            problem = i > 0 ? "didn't resume the TLS session" : "resumed a session the server can't know";
+        }
+        if (!problem.empty()) {
+            printf("%-24s  run %d %s (expected \"%s\")\n", test.name, i + 1, problem.c_str(),
+                   retry_policies[test.expected].name);
+            if (run.result == FAILURE_CONNECTION && !host_socket_stats.last_error.empty()) {
+                printf("%-24s  last connection error: %s\n", "", host_socket_stats.last_error.c_str());
+            }
+            failed++;
+        }
+
+        if (csv) {
+            fprintf(csv, "\"%s\",%d,%s,%lu,%lu,%lu,%zu,%s,%d,%d\n", test.name, i + 1,
+                    retry_policies[run.result].name, run.fetch_ms, run.headers_ms, run.first_byte_ms,
+                    run.bytes, run.stop_reason.c_str(), run.resumed, problem.empty());
+        }
+    }
+    stop_mock_server();
+
+    std::sort(fetch_times.begin(), fetch_times.end());
+    std::sort(header_times.begin(), header_times.end());
+    printf("%-24s %3d/%-3d %-17s %6lu %6lu %6lu %6lu %6lu %8lu\n", test.name, runs - failed, runs,
+           retry_policies[test.expected].name, fetch_times.front(), percentile(fetch_times, 0.5),
+           percentile(fetch_times, 0.9), percentile(fetch_times, 0.99), fetch_times.back(),
+           percentile(header_times, 0.5));
+    return failed;
+}
+
+
+static void print_usage(){
+    fprintf(stderr, "usage: fetch_test [--runs N] [--only TEXT] [--quick] [--csv FILE] [--serial]\n");
+}
+
+
+int main(int argc, char** argv){
+    int runs = 20;
+    const char* only = nullptr;
+    bool quick = false;
+    const char* csv_name = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(option, "--serial") == 0) {
+            host_serial_echo = true;
+            continue;
+        } else if (strcmp(option, "--quick") == 0) {
+            quick = true;
+            continue;
+        } else if (value != nullptr && strcmp(option, "--runs") == 0) {
+            runs = max(1, atoi(value));
+        } else if (value != nullptr && strcmp(option, "--only") == 0) {
+            only = value;
+        } else if (value != nullptr && strcmp(option, "--csv") == 0) {
+            csv_name = value;
+        } else {
+            print_usage();
+            return 2;
+        }
+        i++;
+    }
+    if (USE_HTTPS && !host_socket_has_tls()) {
+        printf("The sketch uses HTTPS, but this was built without OpenSSL\n");
+        return 2;
+    }
+
+    FILE* csv = nullptr;
+    if (csv_name) {
+        csv = fopen(csv_name, "w");
+        if (csv == nullptr) {
+            perror(csv_name);
+            return 2;
+        }
+        fprintf(csv, "case,run,result,fetch_ms,headers_ms,first_byte_ms,bytes,stop_reason,resumed,passed\n");
+    }
+
+    // Start the sketch far enough to fetch: the display, the request path, and a Wi-Fi
+    // connection (all on the virtual clock). Then switch to real time for the network.
+    Wire.begin(OLED_SDA, OLED_SCL);
+    Wire.setClock(I2C_CLOCK);
+    display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS);
+    display.buildGlyphCache();
+    build_layout_screens();
+    build_server_path();
+    load_rtc_data();
+    host_wifi.connect_ms = 0;
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    host_use_real_time();
+    host_socket_start();
+
+    printf("Fetching over %s from mock_server.py (times in ms)\n", USE_HTTPS ? "HTTPS" : "plain HTTP");
+    printf("%-24s %7s %-17s %6s %6s %6s %6s %6s %8s\n", "case", "passed", "expected", "min", "p50", "p90",
+           "p99", "max", "headers");
+    int failed = 0;
+    for (const FetchCase& test : fetch_cases) {
+        if (only && strstr(test.name, only) == nullptr) continue;
+        if ((test.flags & CASE_TLS_ONLY) && !USE_HTTPS) continue;
+        if ((test.flags & CASE_SLOW) && quick) continue;
+        failed += run_case(test, (test.flags & CASE_SLOW) ? 1 : runs, csv);
+    }
+    printf("Connections: %lu made, %lu failed, %lu full TLS handshakes, %lu resumed\n",
+           host_socket_stats.connections, host_socket_stats.failed, host_socket_stats.tls_handshakes,
+           host_socket_stats.tls_resumed);
+    if (csv) fclose(csv);
+
+    if (failed > 0) {
+        printf("%d fetches didn't end the way they should\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1005 @@
+//------------------------------------------------------------------------------------
+// Host (Linux) build: the fake board behind the stub headers
+//------------------------------------------------------------------------------------
+#include "host_hal.h"
+
+#include <ESP8266HTTPClient.h>
+#include <NTPClient.h>
+#include <Wire.h>
+#include <Adafruit_SSD1306.h>
+#include <chrono>
+#include <cstddef>
+#include <new>
+#include <random>
+#include <thread>
+extern "C" {
+#include <user_interface.h>
+#include <gpio.h>
+}
+
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+TwoWire Wire;
+
+uint32_t host_start_unix_time = 1791730800;   // Monday 2026-10-12 00:00 in Japan
+long host_clock_error_ppm = 0;
+uint64_t host_button_period_ms = 0;
+uint64_t host_button_press_ms = 300;
+unsigned long host_timer_wakes = 0;
+unsigned long host_button_wakes = 0;
+HostWiFiConfig host_wifi;
+HostConnection* (*host_open_connection)(const char*, uint16_t, BearSSL::WiFiClientSecure*) = nullptr;
+bool host_serial_echo = false;
+uint16_t host_vcc_mv = 3000;
+unsigned long host_ntp_ms = 60;
+int host_open_tls_connections = 0;
+int host_open_connections = 0;
+bool host_count_heap = false;
+size_t host_heap_used = 0;
+size_t host_heap_peak = 0;
+unsigned long host_heap_blocks = 0;
+
+
+//------------------------------------------------------------------------------------
+// Virtual Clock
+//------------------------------------------------------------------------------------
+static uint64_t awake_us = 0;          // What millis() and micros() count
+static uint64_t slept_us = 0;          // Light sleep (millis() doesn't see it)
+static uint64_t time_limit_us = UINT64_MAX;
+static uint32_t pending_sleep_us = 0;  // Light sleep asked for with wifi_fpm_do_sleep()
+static fpm_wakeup_cb wakeup_callback = nullptr;
+static bool button_wakeup = false;     // gpio_pin_wakeup_enable() was called
+static bool real_time = false;         // Follow the computer's clock (host_use_real_time())
+static std::chrono::steady_clock::time_point real_time_start;
+static uint64_t real_time_start_us = 0;   // awake_us when the clock started following real time
+static uint64_t added_us = 0;          // Simulated costs (e.g. I2C transfers) added on top of real time
+
+
+// In real time mode the awake time is the real time that has passed, plus the simulated costs
+static void follow_real_time(){
+    if (!real_time) return;
+    std::chrono::steady_clock::duration real = std::chrono::steady_clock::now() - real_time_start;
+    awake_us = real_time_start_us + std::chrono::duration_cast<std::chrono::microseconds>(real).count() + added_us;
+}
+
+
+void host_use_real_time(){
+    real_time = true;
+    real_time_start = std::chrono::steady_clock::now();
+    real_time_start_us = awake_us;
+    added_us = 0;
+}
+
+
+void host_set_time_limit_ms(uint64_t limit_ms){
+    time_limit_us = limit_ms * 1000;
+}
+
+
+uint64_t host_elapsed_us(){
+    follow_real_time();
+    return awake_us + slept_us;
+}
+
+
+uint64_t host_slept_us(){
+    return slept_us;
+}
+
+
+void host_advance_us(uint64_t us){
+    if (host_elapsed_us() + us >= time_limit_us) {
+        awake_us = time_limit_us - slept_us;
+        throw HostTimeUp();
+    }
+    awake_us += us;
+    if (real_time) added_us += us;
+}
+
+
+uint32_t host_unix_time(){
+    double real_us = host_elapsed_us() / (1.0 + host_clock_error_ppm / 1000000.0);
+    return host_start_unix_time + (uint32_t)(real_us / 1000000);
+}
+
+
+bool host_in_outage(const std::vector<HostOutage>& outages, uint64_t elapsed_ms){
+    for (const HostOutage& outage : outages) {
+        if (elapsed_ms >= outage.start_ms && elapsed_ms < outage.start_ms + outage.length_ms) return true;
+    }
+    return false;
+}
+
+
+// Time (in us since boot) of the next button press at or after a time
+static uint64_t next_button_press_us(uint64_t after_us){
+    if (host_button_period_ms == 0) return UINT64_MAX;
+    uint64_t period_us = host_button_period_ms * 1000;
+    return (after_us / period_us + 1) * period_us;
+}
+
+
+// The light sleep asked for by wifi_fpm_do_sleep() starts when the CPU is next idle.
+// It ends when the time is up or the button is pressed (if the button's pin was set
+// up to wake us), whichever comes first.
+static void do_light_sleep(){
+    uint64_t timer_us = host_elapsed_us() + pending_sleep_us;
+    uint64_t button_us = button_wakeup ? next_button_press_us(host_elapsed_us()) : UINT64_MAX;
+    uint64_t wake_us = min(timer_us, button_us);
+    pending_sleep_us = 0;
+
+    if (wake_us >= time_limit_us) {
+        slept_us = time_limit_us - awake_us;
+        throw HostTimeUp();
+    }
+    slept_us = wake_us - awake_us;
+    if (button_us < timer_us) {
+        host_button_wakes++;
+    } else {
+        host_timer_wakes++;
+    }
+    if (wakeup_callback) wakeup_callback();
+}
+
+
+unsigned long millis(){
+    follow_real_time();
+    return awake_us / 1000;
+}
+
+
+unsigned long micros(){
+    follow_real_time();
+    return awake_us;
+}
+
+
+void delay(unsigned long ms){
+    if (pending_sleep_us > 0) do_light_sleep();
+    if (real_time) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        if (host_elapsed_us() >= time_limit_us) throw HostTimeUp();
+        return;
+    }
+    host_advance_us(ms * 1000ULL);
+}
+
+
+void yield(){
+}
+
+
+//------------------------------------------------------------------------------------
+// Pins, Random Numbers, Strings
+//------------------------------------------------------------------------------------
+void pinMode(uint8_t pin, uint8_t mode){
+    (void)pin;
+    (void)mode;
+}
+
+
+// Only the Flash button (GPIO0) is connected. It reads LOW while pressed.
+int digitalRead(uint8_t pin){
+    if (pin != 0 || host_button_period_ms == 0) return HIGH;
+    uint64_t elapsed_ms = host_elapsed_us() / 1000;
+    if (elapsed_ms < host_button_period_ms) return HIGH;
+    return elapsed_ms % host_button_period_ms < host_button_press_ms ? LOW : HIGH;
+}
+
+
+static std::mt19937 random_generator(1);
+
+
+void randomSeed(unsigned long seed){
+    random_generator.seed(seed);
+}
+
+
+long random(long max_value){
+    return max_value > 0 ? random_generator() % max_value : 0;
+}
+
+
+long random(long min_value, long max_value){
+    return min_value >= max_value ? min_value : min_value + random(max_value - min_value);
+}
+
+
+size_t host_strlcpy(char* destination, const char* source, size_t size){
+    size_t length = strlen(source);
+    if (size > 0) {
+        size_t n = min(length, size - 1);
+        memcpy(destination, source, n);
+        destination[n] = '\0';
+    }
+    return length;
+}
+
+
+//------------------------------------------------------------------------------------
+// Print, Stream, Serial
+//------------------------------------------------------------------------------------
+size_t Print::write(const uint8_t* buffer, size_t size){
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+}
+
+
+size_t Print::print(long value){
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", value);
+    return write(text);
+}
+
+
+size_t Print::print(unsigned long value){
+    char text[24];
+    snprintf(text, sizeof(text), "%lu", value);
+    return write(text);
+}
+
+
+size_t Print::print(double value, int digits){
+    char text[48];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return write(text);
+}
+
+
+size_t Print::printf(const char* format, ...){
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0) return 0;
+    if ((size_t)length < sizeof(text)) return write((const uint8_t*)text, length);
+
+    std::string long_text(length + 1, '\0');   // Didn't fit, so do it again with room for all of it
+    va_start(args, format);
+    vsnprintf(&long_text[0], long_text.size(), format, args);
+    va_end(args);
+    return write((const uint8_t*)long_text.data(), length);
+}
+
+
+size_t Stream::readBytes(char* buffer, size_t length){
+    size_t n = 0;
+    while (n < length) {
+        unsigned long start = millis();
+        while (available() == 0 && millis() - start < stream_timeout) delay(1);
+        int c = read();
+        if (c < 0) break;
+        buffer[n++] = c;
+    }
+    return n;
+}
+
+
+size_t HardwareSerial::write(uint8_t c){
+    if (host_serial_echo) putchar(c);
+    return 1;
+}
+
+
+//------------------------------------------------------------------------------------
+// ESP Object
+//------------------------------------------------------------------------------------
+static uint8_t rtc_memory[512];
+static bool rtc_memory_ready = false;
+
+
+// Rough numbers: a TLS connection needs about 20 KB of buffers on the ESP8266. What
+// the sketch (and the libraries it calls) allocated is counted by operator new below.
+uint32_t EspClass::getFreeHeap(){
+    return 46000 - host_open_tls_connections * 20000 - host_open_connections * 1500 - host_heap_used;
+}
+
+
+uint32_t EspClass::getMaxFreeBlockSize(){
+    return getFreeHeap() - 1200;
+}
+
+
+uint8_t EspClass::getHeapFragmentation(){
+    return 100 - getMaxFreeBlockSize() * 100 / getFreeHeap();
+}
+
+
+uint16_t EspClass::getVcc(){
+    return host_vcc_mv;
+}
+
+
+uint32_t EspClass::random(){
+    return random_generator();
+}
+
+
+// The RTC memory is not cleared at power on, so it starts out as garbage
+static void prepare_rtc_memory(){
+    if (rtc_memory_ready) return;
+    for (size_t i = 0; i < sizeof(rtc_memory); i++) rtc_memory[i] = 0xA5 ^ i;
+    rtc_memory_ready = true;
+}
+
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size){
+    prepare_rtc_memory();
+    if (offset * 4 + size > sizeof(rtc_memory)) return false;
+    memcpy(data, rtc_memory + offset * 4, size);
+    return true;
+}
+
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size){
+    prepare_rtc_memory();
+    if (offset * 4 + size > sizeof(rtc_memory)) return false;
+    memcpy(rtc_memory + offset * 4, data, size);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------
+// Light Sleep and the RTC Timer (SDK functions)
+//------------------------------------------------------------------------------------
+extern "C" {
+
+uint32_t system_get_rtc_time(void){
+    return (uint32_t)host_elapsed_us();   // One tick per microsecond
+}
+
+
+uint32_t system_rtc_clock_cali_proc(void){
+    return 1 << 12;   // Microseconds per tick, times 4096
+}
+
+
+bool wifi_set_opmode_current(uint8_t opmode){
+    (void)opmode;
+    return true;
+}
+
+
+void wifi_fpm_open(void){
+}
+
+
+void wifi_fpm_close(void){
+}
+
+
+void wifi_fpm_do_wakeup(void){
+}
+
+
+int8_t wifi_fpm_do_sleep(uint32_t sleep_time_us){
+    pending_sleep_us = sleep_time_us;
+    return 0;
+}
+
+
+void wifi_fpm_set_sleep_type(enum sleep_type type){
+    (void)type;
+}
+
+
+void wifi_fpm_set_wakeup_cb(fpm_wakeup_cb callback){
+    wakeup_callback = callback;
+}
+
+
+void gpio_pin_wakeup_enable(uint32_t pin, GPIO_INT_TYPE type){
+    button_wakeup = pin == 0 && type == GPIO_PIN_INTR_LOLEVEL;   // The Flash button reads LOW when pressed
+}
+
+
+void gpio_pin_wakeup_disable(void){
+    button_wakeup = false;
+}
+
+}   // extern "C"
+
+
+//------------------------------------------------------------------------------------
+// Wi-Fi
+//------------------------------------------------------------------------------------
+static bool radio_on = true;
+static bool connecting = false;        // begin() was called (and not disconnected since)
+static uint64_t connected_at_us = 0;   // When the connection attempt finishes
+static uint8_t bssid[6] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+
+
+bool ESP8266WiFiClass::mode(WiFiMode_t mode){
+    if (mode == WIFI_OFF) connecting = false;
+    return true;
+}
+
+
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char* password, int32_t channel,
+                                    const uint8_t* bssid, bool connect){
+    (void)ssid;
+    (void)password;
+    if (!connect) return WL_DISCONNECTED;
+    bool quick = channel != 0 && bssid != nullptr;
+    connecting = true;
+    connected_at_us = host_elapsed_us() + (quick ? host_wifi.quick_connect_ms : host_wifi.connect_ms) * 1000ULL;
+    return WL_DISCONNECTED;
+}
+
+
+bool ESP8266WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1){
+    (void)local_ip;
+    (void)gateway;
+    (void)subnet;
+    (void)dns1;
+    return true;
+}
+
+
+bool ESP8266WiFiClass::disconnect(bool wifi_off){
+    (void)wifi_off;
+    connecting = false;
+    return true;
+}
+
+
+wl_status_t ESP8266WiFiClass::status(){
+    if (!radio_on || !connecting || host_elapsed_us() < connected_at_us) return WL_DISCONNECTED;
+    if (host_in_outage(host_wifi.outages, host_elapsed_us() / 1000)) return WL_NO_SSID_AVAIL;
+    if (host_wifi.wrong_password) return WL_WRONG_PASSWORD;
+    return WL_CONNECTED;
+}
+
+
+int32_t ESP8266WiFiClass::channel(){
+    return 6;
+}
+
+
+uint8_t* ESP8266WiFiClass::BSSID(){
+    return bssid;
+}
+
+
+IPAddress ESP8266WiFiClass::localIP(){
+    return IPAddress(192, 168, 1, 42);
+}
+
+
+IPAddress ESP8266WiFiClass::gatewayIP(){
+    return IPAddress(192, 168, 1, 1);
+}
+
+
+IPAddress ESP8266WiFiClass::subnetMask(){
+    return IPAddress(255, 255, 255, 0);
+}
+
+
+IPAddress ESP8266WiFiClass::dnsIP(uint8_t number){
+    (void)number;
+    return IPAddress(192, 168, 1, 1);
+}
+
+
+bool ESP8266WiFiClass::forceSleepBegin(uint32_t sleep_us){
+    (void)sleep_us;
+    radio_on = false;
+    connecting = false;
+    return true;
+}
+
+
+bool ESP8266WiFiClass::forceSleepWake(){
+    radio_on = true;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------
+// Network Clients
+//------------------------------------------------------------------------------------
+int WiFiClient::connect(const char* host, uint16_t port){
+    stop();
+    if (WiFi.status() != WL_CONNECTED || host_open_connection == nullptr) return 0;
+    connection = host_open_connection(host, port, nullptr);
+    if (connection) host_open_connections++;
+    return connection != nullptr;
+}
+
+
+uint8_t WiFiClient::connected(){
+    return connection != nullptr && connection->connected();
+}
+
+
+void WiFiClient::stop(){
+    if (connection == nullptr) return;
+    delete connection;
+    connection = nullptr;
+    host_open_connections--;
+}
+
+
+int WiFiClient::available(){
+    return connection ? connection->available() : 0;
+}
+
+
+int WiFiClient::read(){
+    return connection ? connection->read() : -1;
+}
+
+
+int WiFiClient::peek(){
+    return connection ? connection->peek() : -1;
+}
+
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size){
+    return connection ? connection->write(buffer, size) : 0;
+}
+
+
+namespace BearSSL {
+
+int WiFiClientSecure::connect(const char* host, uint16_t port){
+    stop();
+    session_resumed = false;
+    if (WiFi.status() != WL_CONNECTED || host_open_connection == nullptr) return 0;
+    connection = host_open_connection(host, port, this);
+    if (connection) host_open_connections++;
+    return connection != nullptr;
+}
+
+
+bool WiFiClientSecure::setFingerprint(const char* text){
+    int count = 0;
+    while (*text && count < 20) {
+        if (!isxdigit(text[0]) || !isxdigit(text[1])) {   // Skip the spaces or colons between the bytes
+            text++;
+            continue;
+        }
+        char hex[3] = { text[0], text[1], '\0' };
+        fingerprint[count++] = strtoul(hex, nullptr, 16);
+        text += 2;
+    }
+    have_fingerprint = count == 20;
+    return have_fingerprint;
+}
+
+}   // namespace BearSSL
+
+
+//------------------------------------------------------------------------------------
+// HTTP Client
+//------------------------------------------------------------------------------------
+bool HTTPClient::begin(WiFiClient& client, const char* host, uint16_t port, const char* uri, bool https){
+    (void)https;
+    this->client = &client;
+    this->host = host;
+    this->port = port;
+    this->uri = uri;
+    request_headers.clear();
+    return true;
+}
+
+
+void HTTPClient::end(){
+    if (client) client->stop();
+}
+
+
+void HTTPClient::addHeader(const String& name, const String& value){
+    request_headers += std::string(name.c_str()) + ": " + value.c_str() + "\r\n";
+}
+
+
+void HTTPClient::collectHeaders(const char* header_keys[], const size_t count){
+    collected.clear();
+    for (size_t i = 0; i < count; i++) collected.push_back({ header_keys[i], "", false });
+}
+
+
+// Read one header line (without the "\r\n"). False on a timeout or a lost connection.
+bool HTTPClient::read_line(std::string& line){
+    line.clear();
+    unsigned long start = millis();
+    while (true) {
+        if (client->available() == 0) {
+            if (!client->connected() || millis() - start >= timeout) return false;
+            delay(1);
+            continue;
+        }
+        int c = client->read();
+        if (c == '\n') break;
+        if (c != '\r') line += (char)c;
+    }
+    return true;
+}
+
+
+// Send the request and read the reply up to the body. Returns the HTTP status code,
+// or one of the (negative) HTTPC_ERROR codes.
+int HTTPClient::GET(){
+    if (!client->connect(host.c_str(), port)) return HTTPC_ERROR_CONNECTION_FAILED;
+
+    std::string request = "GET " + uri + (http10 ? " HTTP/1.0\r\n" : " HTTP/1.1\r\n");
+    request += "Host: " + host;
+    if (port != 80 && port != 443) request += ":" + std::to_string(port);
+    request += "\r\nUser-Agent: ESP8266HTTPClient\r\nConnection: close\r\n";
+    if (!http10) request += "Accept-Encoding: identity;q=1,chunked;q=0.1,*;q=0\r\n";
+    request += request_headers + "\r\n";
+    if (client->write((const uint8_t*)request.data(), request.size()) != request.size()) {
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+    }
+
+    for (Header& header : collected) {
+        header.value.clear();
+        header.found = false;
+    }
+
+    std::string line;
+    if (!read_line(line)) return client->connected() ? HTTPC_ERROR_READ_TIMEOUT : HTTPC_ERROR_CONNECTION_LOST;
+    int code = 0;
+    if (sscanf(line.c_str(), "HTTP/%*d.%*d %d", &code) != 1 || code <= 0) return HTTPC_ERROR_NO_HTTP_SERVER;
+
+    while (true) {
+        if (!read_line(line)) return client->connected() ? HTTPC_ERROR_READ_TIMEOUT : HTTPC_ERROR_CONNECTION_LOST;
+        if (line.empty()) break;   // The end of the headers
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        std::string name = line.substr(0, colon);
+        size_t value_start = line.find_first_not_of(' ', colon + 1);
+        for (Header& header : collected) {
+            if (strcasecmp(header.name.c_str(), name.c_str()) == 0) {
+                header.value = value_start == std::string::npos ? "" : line.substr(value_start);
+                header.found = true;
+            }
+        }
+    }
+    return code;
+}
+
+
+String HTTPClient::header(const char* name){
+    for (const Header& header : collected) {
+        if (strcasecmp(header.name.c_str(), name) == 0) return String(header.value);
+    }
+    return String();
+}
+
+
+bool HTTPClient::hasHeader(const char* name){
+    for (const Header& header : collected) {
+        if (strcasecmp(header.name.c_str(), name) == 0) return header.found;
+    }
+    return false;
+}
+
+
+//------------------------------------------------------------------------------------
+// NTP
+//------------------------------------------------------------------------------------
+bool NTPClient::update(){
+    if (WiFi.status() != WL_CONNECTED) return false;
+    delay(host_ntp_ms);
+    synced = true;
+    return true;
+}
+
+
+unsigned long NTPClient::getEpochTime(){
+    return synced ? host_unix_time() + offset_seconds : offset_seconds;
+}
+
+
+//------------------------------------------------------------------------------------
+// I2C and the Display
+//------------------------------------------------------------------------------------
+uint8_t host_display_ram[HOST_DISPLAY_WIDTH * HOST_DISPLAY_PAGES];
+
+// The SSD1306 controller: the write window and position, and a command that is
+// still waiting for its arguments (they may come in the next transfer)
+static struct {
+    uint8_t mode = 2;                 // Memory addressing mode: 0 horizontal, 1 vertical, 2 page
+    int column_start = 0;
+    int column_end = HOST_DISPLAY_WIDTH - 1;
+    int page_start = 0;
+    int page_end = HOST_DISPLAY_PAGES - 1;
+    int column = 0;
+    int page = 0;
+    uint8_t command[8];
+    int command_length = 0;           // Bytes of the command received so far
+} display_controller;
+
+
+// Number of bytes of an SSD1306 command (with its arguments)
+static int display_command_size(uint8_t command){
+    switch (command) {
+        case 0x26: case 0x27: return 7;             // Horizontal scroll
+        case 0x29: case 0x2A: return 6;             // Vertical and horizontal scroll
+        case 0x21: case 0x22: case 0xA3: return 3;  // Column and page window, vertical scroll area
+        case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3: case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+
+static void display_run_command(const uint8_t* command){
+    auto& controller = display_controller;
+    switch (command[0]) {
+        case 0x20:   // Memory addressing mode
+            controller.mode = command[1] & 3;
+            break;
+        case 0x21:   // Column window (in horizontal or vertical mode)
+            controller.column_start = controller.column = command[1] & 0x7F;
+            controller.column_end = command[2] & 0x7F;
+            break;
+        case 0x22:   // Page window (in horizontal or vertical mode)
+            controller.page_start = controller.page = command[1] & 7;
+            controller.page_end = command[2] & 7;
+            break;
+        default:
+            if (command[0] < 0x10) {   // Low half of the column (page mode)
+                controller.column = (controller.column & 0xF0) | command[0];
+            } else if (command[0] < 0x20) {   // High half of the column (page mode)
+                controller.column = (controller.column & 0x0F) | ((command[0] & 7) << 4);
+            } else if (command[0] >= 0xB0 && command[0] <= 0xB7) {   // Page (page mode)
+                controller.page = command[0] & 7;
+            }
+            break;
+    }
+}
+
+
+// Write one data byte to the display memory and move to the next position
+static void display_write_data(uint8_t data){
+    auto& controller = display_controller;
+    if (controller.column < HOST_DISPLAY_WIDTH) {
+        host_display_ram[controller.page * HOST_DISPLAY_WIDTH + controller.column] = data;
+    }
+    if (controller.mode == 2) {   // Page mode: stay in the page, stop at the end
+        if (controller.column < HOST_DISPLAY_WIDTH - 1) controller.column++;
+    } else if (controller.mode == 0) {   // Horizontal: across the window, then the next page
+        if (++controller.column > controller.column_end) {
+            controller.column = controller.column_start;
+            if (++controller.page > controller.page_end) controller.page = controller.page_start;
+        }
+    } else {   // Vertical: down the window, then the next column
+        if (++controller.page > controller.page_end) {
+            controller.page = controller.page_start;
+            if (++controller.column > controller.column_end) controller.column = controller.column_start;
+        }
+    }
+}
+
+
+// A transfer to the display: a control byte (0x00 commands, 0x40 data), then the bytes
+static void display_receive(const uint8_t* bytes, size_t size){
+    if (size == 0) return;
+    bool data = bytes[0] & 0x40;
+    for (size_t i = 1; i < size; i++) {
+        if (data) {
+            display_write_data(bytes[i]);
+            continue;
+        }
+        auto& controller = display_controller;
+        controller.command[controller.command_length++] = bytes[i];
+        if (controller.command_length == display_command_size(controller.command[0])) {
+            display_run_command(controller.command);
+            controller.command_length = 0;
+        }
+    }
+}
+
+
+// Sending takes 9 bits per byte (8 data bits and the acknowledge), plus the start and stop
+uint8_t TwoWire::endTransmission(bool send_stop){
+    (void)send_stop;
+    if (address == HOST_DISPLAY_ADDRESS) display_receive(buffer, pending);
+    size_t bytes = pending + 1;   // The address byte comes first
+    bytes_sent += bytes;
+    host_advance_us((bytes * 9 + 2) * 1000000ULL / clock);
+    pending = 0;
+    return 0;
+}
+
+
+Adafruit_SSD1306::Adafruit_SSD1306(uint8_t w, uint8_t h, TwoWire* twi, int8_t rst_pin,
+                                   uint32_t clkDuring, uint32_t clkAfter)
+    : Adafruit_GFX(w, h), wire(twi), wireClk(clkDuring), restoreClk(clkAfter) {
+    (void)rst_pin;
+}
+
+
+Adafruit_SSD1306::~Adafruit_SSD1306(){
+    delete[] buffer;
+}
+
+
+bool Adafruit_SSD1306::begin(uint8_t switchvcc, uint8_t i2caddr, bool reset){
+    (void)switchvcc;
+    (void)reset;
+    if (buffer == nullptr) buffer = new (std::nothrow) uint8_t[WIDTH * ((HEIGHT + 7) / 8)];
+    if (buffer == nullptr) return false;
+    if (i2caddr != 0) this->i2caddr = i2caddr;
+    clearDisplay();
+
+    // The setup commands of the real library (for a 128x64 display). 0x20 0x00 sets the
+    // horizontal addressing mode, which the page and column windows need.
+    static const uint8_t init_commands[] = {
+        0xAE, 0xD5, 0x80, 0xA8, 0x3F, 0xD3, 0x00, 0x40, 0x8D, 0x14, 0x20, 0x00, 0xA1,
+        0xC8, 0xDA, 0x12, 0x81, 0xCF, 0xD9, 0xF1, 0xDB, 0x40, 0xA4, 0xA6, 0x2E, 0xAF
+    };
+    ssd1306_commandList(init_commands, sizeof(init_commands));
+    display();
+    return true;
+}
+
+
+void Adafruit_SSD1306::display(){
+    static const uint8_t window[] = { SSD1306_PAGEADDR, 0, 0xFF, SSD1306_COLUMNADDR, 0 };
+    ssd1306_commandList(window, sizeof(window));
+    const uint8_t last_column = WIDTH - 1;   // Sent on its own, like the real library does
+    ssd1306_commandList(&last_column, 1);
+    wire->setClock(wireClk);
+    size_t size = WIDTH * ((HEIGHT + 7) / 8);
+    for (size_t i = 0; i < size; i += 31) {   // The real library sends 31 bytes at a time
+        wire->beginTransmission(i2caddr);
+        wire->write((uint8_t)0x40);
+        wire->write(buffer + i, min((size_t)31, size - i));
+        wire->endTransmission();
+    }
+    wire->setClock(restoreClk);
+}
+
+
+void Adafruit_SSD1306::clearDisplay(){
+    memset(buffer, 0, WIDTH * ((HEIGHT + 7) / 8));
+}
+
+
+void Adafruit_SSD1306::drawPixel(int16_t x, int16_t y, uint16_t color){
+    if (x < 0 || y < 0 || x >= WIDTH || y >= HEIGHT) return;
+    uint8_t* pixel = &buffer[x + (y / 8) * WIDTH];
+    uint8_t bit = 1 << (y & 7);
+    if (color == SSD1306_WHITE) {
+        *pixel |= bit;
+    } else if (color == SSD1306_BLACK) {
+        *pixel &= ~bit;
+    } else {
+        *pixel ^= bit;
+    }
+}
+
+
+void Adafruit_SSD1306::ssd1306_commandList(const uint8_t* c, uint8_t n){
+    wire->beginTransmission(i2caddr);
+    wire->write((uint8_t)0x00);   // "Commands follow"
+    wire->write(c, n);
+    wire->endTransmission();
+}
+
+
+void Adafruit_GFX::drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color){
+    int dx = abs(x1 - x0);
+    int dy = -abs(y1 - y0);
+    int step_x = x0 < x1 ? 1 : -1;
+    int step_y = y0 < y1 ? 1 : -1;
+    int error = dx + dy;
+    while (true) {
+        drawPixel(x0, y0, color);
+        if (x0 == x1 && y0 == y1) break;
+        if (2 * error >= dy) {
+            error += dy;
+            x0 += step_x;
+        }
+        if (2 * error <= dx) {
+            error += dx;
+            y0 += step_y;
+        }
+    }
+}
+
+
+void Adafruit_GFX::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color){
+    for (int16_t row = y; row < y + h; row++) {
+        for (int16_t column = x; column < x + w; column++) drawPixel(column, row, color);
+    }
+}
+
+
+// Not the real font: each printable character gets its own pattern of 5 x 7 pixels
+static uint8_t font_column(unsigned char c, int column){
+    if (c <= ' ' || c > '~') return 0;
+    uint32_t bits = (c * 2654435761u) >> (column * 5);
+    return (bits & 0x7F) | 0x01;
+}
+
+
+void Adafruit_GFX::drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size){
+    for (int column = 0; column < 6; column++) {
+        uint8_t bits = column < 5 ? font_column(c, column) : 0;
+        for (int row = 0; row < 8; row++, bits >>= 1) {
+            if (bits & 1) {
+                fillRect(x + column * size, y + row * size, size, size, color);
+            } else if (bg != color) {
+                fillRect(x + column * size, y + row * size, size, size, bg);
+            }
+        }
+    }
+}
+
+
+size_t Adafruit_GFX::write(uint8_t c){
+    if (c == '\n') {
+        cursor_x = 0;
+        cursor_y += textsize_y * 8;
+    } else if (c != '\r') {
+        if (wrap && cursor_x + textsize_x * 6 > _width) {
+            cursor_x = 0;
+            cursor_y += textsize_y * 8;
+        }
+        drawChar(cursor_x, cursor_y, c, textcolor, textbgcolor, textsize_x);
+        cursor_x += textsize_x * 6;
+    }
+    return 1;
+}
+
+
+//------------------------------------------------------------------------------------
+// Heap Counting
+//------------------------------------------------------------------------------------
+// Every block gets a small header with its size, and whether it was counted (a block
+// allocated outside the sketch may be freed inside it, or the other way around).
+struct alignas(std::max_align_t) HeapHeader {
+    size_t size;
+    bool counted;
+};
+
+
+static void* heap_allocate(size_t size){
+    HeapHeader* header = (HeapHeader*)malloc(sizeof(HeapHeader) + size);
+    if (header == nullptr) return nullptr;
+    header->size = size;
+    header->counted = host_count_heap;
+    if (header->counted) {
+        host_heap_used += size;
+        host_heap_blocks++;
+        host_heap_peak = max(host_heap_peak, host_heap_used);
+    }
+    return header + 1;
+}
+
+
+static void heap_free(void* block){
+    if (block == nullptr) return;
+    HeapHeader* header = (HeapHeader*)block - 1;
+    if (header->counted) {
+        host_heap_used -= header->size;
+        host_heap_blocks--;
+    }
+    free(header);
+}
+
+
+void* operator new(size_t size){
+    void* block = heap_allocate(size);
+    if (block == nullptr) throw std::bad_alloc();
+    return block;
+}
+void* operator new[](size_t size){ return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return heap_allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return heap_allocate(size); }
+void operator delete(void* block) noexcept { heap_free(block); }
+void operator delete[](void* block) noexcept { heap_free(block); }
+void operator delete(void* block, size_t) noexcept { heap_free(block); }
+void operator delete[](void* block, size_t) noexcept { heap_free(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { heap_free(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { heap_free(block); }
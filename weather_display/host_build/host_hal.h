@@ -0,0 +1,81 @@
+//------------------------------------------------------------------------------------
+// Host (Linux) build: the controls of the fake board
+//
+// Everything the sketch sees through the stub headers (time, the Flash button, the
+// Wi-Fi, the network) is set up here by the program that runs the sketch.
+//
+// Time is virtual. It only moves on when the sketch waits (delay(), light sleep,
+// network and I2C transfers) or when the runner says so, which is how a whole
+// week of loop() runs in well under a second. With real network connections
+// (host_socket.h) the clock has to follow the computer's clock instead.
+//------------------------------------------------------------------------------------
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <vector>
+
+// Thrown by the virtual clock once the time limit is reached. The runner catches it
+// to end the simulation, wherever the sketch was at that moment.
+struct HostTimeUp {};
+
+// Virtual Clock
+void host_set_time_limit_ms(uint64_t limit_ms);   // Throw HostTimeUp once this much time has passed
+uint64_t host_elapsed_us();           // Time since boot (awake and in light sleep)
+uint64_t host_slept_us();             // Time spent in light sleep (which millis() doesn't count)
+void host_advance_us(uint64_t us);    // Move the clock on while awake (busy, or waiting)
+uint32_t host_unix_time();            // The real unix time (what the servers' clocks say)
+extern uint32_t host_start_unix_time; // Unix time at boot
+extern long host_clock_error_ppm;     // How much faster the board's clock runs than real time
+void host_use_real_time();            // Follow the computer's clock from now on (for real network connections)
+
+// Flash Button (pressed for host_button_press_ms every host_button_period_ms, 0 = never)
+extern uint64_t host_button_period_ms;
+extern uint64_t host_button_press_ms;
+
+// Light sleep, counted by the board (to check the sketch's own counts)
+extern unsigned long host_timer_wakes;     // Light sleeps that ended because the time was up
+extern unsigned long host_button_wakes;    // ... because the button was pressed (only if it can wake us)
+
+// Wi-Fi
+struct HostOutage {
+    uint64_t start_ms;                // Time since boot when it starts
+    uint64_t length_ms;
+};
+struct HostWiFiConfig {
+    unsigned long quick_connect_ms = 400;    // Connect time with a known access point and channel
+    unsigned long connect_ms = 2500;         // Connect time with a channel scan (and DHCP)
+    bool wrong_password = false;
+    std::vector<HostOutage> outages;         // When the access point is switched off
+};
+extern HostWiFiConfig host_wifi;
+bool host_in_outage(const std::vector<HostOutage>& outages, uint64_t elapsed_ms);
+
+// Network connections. WiFiClient::connect() (and WiFiClientSecure) calls this to get
+// a connection to host:port. tls is nullptr for plain TCP. Returns nullptr if the
+// connection fails.
+namespace BearSSL { class WiFiClientSecure; }
+extern HostConnection* (*host_open_connection)(const char* host, uint16_t port, BearSSL::WiFiClientSecure* tls);
+
+// Other Board Settings
+extern bool host_serial_echo;         // Copy Serial output to stdout
+extern uint16_t host_vcc_mv;          // What ESP.getVcc() reads
+extern unsigned long host_ntp_ms;     // How long an NTP sync takes
+extern int host_open_tls_connections; // TLS connections open now (each one uses a lot of heap)
+extern int host_open_connections;     // All connections open now
+
+// Heap. Every C++ allocation (new, and so std::string, std::vector, ... in the stubs)
+// made while host_count_heap is true is counted as the sketch's, and ESP.getFreeHeap()
+// goes down by its size. The runner turns it on while setup() or loop() runs.
+extern bool host_count_heap;
+extern size_t host_heap_used;         // Bytes the sketch has allocated now
+extern size_t host_heap_peak;         // The most it ever had
+extern unsigned long host_heap_blocks;   // Blocks the sketch has allocated now
+
+// The display's own memory (GDDRAM), one byte per column of each 8-pixel page, like
+// the screen buffer. It is filled from the commands and data sent over I2C, so it
+// shows what the real display would show.
+#define HOST_DISPLAY_ADDRESS 0x3C
+#define HOST_DISPLAY_WIDTH 128
+#define HOST_DISPLAY_PAGES 8
+extern uint8_t host_display_ram[HOST_DISPLAY_WIDTH * HOST_DISPLAY_PAGES];
@@ -0,0 +1,349 @@
+//------------------------------------------------------------------------------------
+// Host (Linux) build: real network connections
+//------------------------------------------------------------------------------------
+#include "host_socket.h"
+
+#include <WiFiClientSecure.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef HOST_HAVE_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#else
+typedef struct ssl_st SSL;
+#endif
+
+HostSocketConfig host_socket;
+HostSocketStats host_socket_stats;
+
+
+// Wait until the socket can be read (or written), at most until the deadline (millis()).
+// False on a timeout.
+static bool wait_for_socket(int fd, bool for_writing, unsigned long deadline){
+    long left = (long)(deadline - millis());
+    if (left <= 0) return false;
+    struct pollfd waiting = { fd, (short)(for_writing ? POLLOUT : POLLIN), 0 };
+    return poll(&waiting, 1, left) > 0;
+}
+
+
+// Open a TCP connection (non-blocking from then on). Returns -1 if it failed.
+static int connect_socket(unsigned long deadline){
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(host_socket.port);
+    if (inet_pton(AF_INET, host_socket.address.c_str(), &address.sin_addr) != 1) {
+        host_socket_stats.last_error = "bad address " + host_socket.address;
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        host_socket_stats.last_error = strerror(errno);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // lwIP sends small writes right away too
+
+    int error = 0;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        error = errno;
+        if (error == EINPROGRESS) {
+            if (wait_for_socket(fd, true, deadline)) {
+                socklen_t length = sizeof(error);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            } else {
+                error = ETIMEDOUT;
+            }
+        }
+    }
+    if (error != 0) {
+        host_socket_stats.last_error = strerror(error);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+//------------------------------------------------------------------------------------
+// TLS (like BearSSL on the board)
+//------------------------------------------------------------------------------------
+#ifdef HOST_HAVE_OPENSSL
+
+static SSL_CTX* tls_context = nullptr;
+
+
+static std::string tls_error(){
+    char text[256];
+    ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+    return text;
+}
+
+
+// BearSSL only speaks TLS 1.2 (on the ESP8266), resumes sessions by their ID, and
+// doesn't know the extended master secret. The certificate is checked by hand
+// (against the fingerprint), like setInsecure() / setFingerprint() do.
+static SSL_CTX* get_tls_context(){
+    if (tls_context) return tls_context;
+    tls_context = SSL_CTX_new(TLS_client_method());
+    if (tls_context == nullptr) return nullptr;
+    SSL_CTX_set_min_proto_version(tls_context, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(tls_context, TLS1_2_VERSION);
+    SSL_CTX_set_options(tls_context, SSL_OP_NO_TICKET | SSL_OP_NO_EXTENDED_MASTER_SECRET);
+    SSL_CTX_set_verify(tls_context, SSL_VERIFY_NONE, nullptr);
+    SSL_CTX_set_session_cache_mode(tls_context, SSL_SESS_CACHE_OFF);   // The sketch keeps the session itself
+    return tls_context;
+}
+
+
+// Turn the sketch's saved session back into an OpenSSL session (nullptr if it can't be used)
+static SSL_SESSION* session_from_bearssl(SSL* ssl, const BearSSL::Session& saved){
+    if (saved.session_id_len == 0 || saved.session_id_len > sizeof(saved.session_id)) return nullptr;
+    const unsigned char cipher_id[2] = { (unsigned char)(saved.cipher_suite >> 8), (unsigned char)saved.cipher_suite };
+    const SSL_CIPHER* cipher = SSL_CIPHER_find(ssl, cipher_id);
+    SSL_SESSION* session = SSL_SESSION_new();
+    if (cipher == nullptr || session == nullptr
+        || !SSL_SESSION_set1_id(session, saved.session_id, saved.session_id_len)
+        || !SSL_SESSION_set1_master_key(session, saved.master_secret, sizeof(saved.master_secret))
+        || !SSL_SESSION_set_cipher(session, cipher)
+        || !SSL_SESSION_set_protocol_version(session, saved.version)) {
+        SSL_SESSION_free(session);
+        return nullptr;
+    }
+    return session;
+}
+
+
+// Save the session of a finished handshake where the sketch keeps it
+static void session_to_bearssl(SSL* ssl, BearSSL::Session& saved){
+    SSL_SESSION* session = SSL_get_session(ssl);
+    unsigned int id_length = 0;
+    const unsigned char* id = session ? SSL_SESSION_get_id(session, &id_length) : nullptr;
+    if (id == nullptr || id_length == 0 || id_length > sizeof(saved.session_id)
+        || SSL_SESSION_get_master_key(session, saved.master_secret, sizeof(saved.master_secret)) != sizeof(saved.master_secret)) {
+        saved.session_id_len = 0;   // Nothing we could resume
+        return;
+    }
+    memcpy(saved.session_id, id, id_length);
+    saved.session_id_len = id_length;
+    saved.version = SSL_SESSION_get_protocol_version(session);
+    saved.cipher_suite = SSL_CIPHER_get_protocol_id(SSL_SESSION_get0_cipher(session));
+}
+
+
+// True if the server's certificate has the fingerprint the sketch asked for
+static bool fingerprint_matches(SSL* ssl, const BearSSL::WiFiClientSecure& client){
+    X509* certificate = SSL_get1_peer_certificate(ssl);
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    bool ok = certificate && X509_digest(certificate, EVP_sha1(), digest, &length)
+              && length == sizeof(client.fingerprint) && memcmp(digest, client.fingerprint, length) == 0;
+    X509_free(certificate);
+    return ok;
+}
+
+
+// Do the TLS handshake on a connected socket. Returns nullptr if it failed.
+static SSL* start_tls(int fd, const char* host, BearSSL::WiFiClientSecure& client, unsigned long deadline){
+    if (!client.insecure && !client.have_fingerprint) {
+        host_socket_stats.last_error = "no fingerprint and not insecure (BearSSL would need trust anchors)";
+        return nullptr;
+    }
+    SSL_CTX* context = get_tls_context();
+    SSL* ssl = context ? SSL_new(context) : nullptr;
+    if (ssl == nullptr) {
+        host_socket_stats.last_error = tls_error();
+        return nullptr;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, host);
+    if (client.session) {
+        SSL_SESSION* session = session_from_bearssl(ssl, *client.session);
+        if (session) {
+            SSL_set_session(ssl, session);
+            SSL_SESSION_free(session);   // The SSL keeps its own reference
+        }
+    }
+
+    while (true) {
+        int result = SSL_connect(ssl);
+        if (result == 1) break;
+        int error = SSL_get_error(ssl, result);
+        bool waiting = error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+        if (!waiting || !wait_for_socket(fd, error == SSL_ERROR_WANT_WRITE, deadline)) {
+            host_socket_stats.last_error = waiting ? "TLS handshake timed out" : "TLS handshake failed: " + tls_error();
+            SSL_free(ssl);
+            return nullptr;
+        }
+    }
+
+    // A resumed session has no certificate: the server proved it is the same one by
+    // knowing the session (BearSSL doesn't check the fingerprint again either)
+    client.session_resumed = SSL_session_reused(ssl);
+    if (client.have_fingerprint && !client.session_resumed && !fingerprint_matches(ssl, client)) {
+        host_socket_stats.last_error = "the certificate doesn't match the fingerprint";
+        SSL_free(ssl);
+        return nullptr;
+    }
+    if (client.session_resumed) host_socket_stats.tls_resumed++;
+    else host_socket_stats.tls_handshakes++;
+    if (client.session) session_to_bearssl(ssl, *client.session);
+    return ssl;
+}
+
+
+bool host_socket_has_tls(){
+    return true;
+}
+
+#else   // No OpenSSL: only plain connections
+
+static SSL* start_tls(int, const char*, BearSSL::WiFiClientSecure&, unsigned long){
+    host_socket_stats.last_error = "built without OpenSSL";
+    return nullptr;
+}
+
+
+bool host_socket_has_tls(){
+    return false;
+}
+
+#endif
+
+
+//------------------------------------------------------------------------------------
+// Connections
+//------------------------------------------------------------------------------------
+// An open socket (with TLS on top, or not). Reading never blocks: available() only
+// reports what has already arrived, and the sketch waits for more with delay(),
+// like on the board.
+class SocketConnection : public HostConnection {
+    public:
+        SocketConnection(int fd, SSL* ssl) : fd(fd), ssl(ssl) {
+            if (ssl) host_open_tls_connections++;
+        }
+        ~SocketConnection() override {
+#ifdef HOST_HAVE_OPENSSL
+            if (ssl) {
+                SSL_shutdown(ssl);   // Send "close notify" (without waiting for the answer)
+                SSL_free(ssl);
+                host_open_tls_connections--;
+            }
+#endif
+            close(fd);
+        }
+
+        int available() override {
+            receive();
+            return received.size() - position;
+        }
+        int read() override { return available() > 0 ? received[position++] : -1; }
+        int peek() override { return available() > 0 ? received[position] : -1; }
+
+        size_t write(const uint8_t* buffer, size_t size) override {
+            size_t sent = 0;
+            unsigned long deadline = millis() + host_socket.connect_timeout_ms;
+            while (sent < size && !closed) {
+                long n = send_some(buffer + sent, size - sent);
+                if (n > 0) sent += n;
+                else if (n < 0 || !wait_for_socket(fd, true, deadline)) break;
+            }
+            return sent;
+        }
+
+        bool connected() override {
+            receive();
+            return !closed || position < received.size();
+        }
+
+    private:
+        int fd;
+        SSL* ssl;
+        std::vector<uint8_t> received;
+        size_t position = 0;
+        bool closed = false;         // The server closed the connection (or it broke)
+
+        // Send what the socket takes right now: the number of bytes, 0 to wait, -1 on an error
+        long send_some(const uint8_t* buffer, size_t size) {
+#ifdef HOST_HAVE_OPENSSL
+            if (ssl) {
+                int n = SSL_write(ssl, buffer, size);
+                if (n > 0) return n;
+                int error = SSL_get_error(ssl, n);
+                return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ? 0 : -1;
+            }
+#endif
+            long n = send(fd, buffer, size, MSG_NOSIGNAL);
+            if (n >= 0) return n;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+
+        // Move whatever has arrived into the receive buffer
+        void receive() {
+            if (closed) return;
+            if (position == received.size()) {
+                received.clear();
+                position = 0;
+            }
+            uint8_t buffer[1460];   // One TCP segment
+            while (true) {
+                long n;
+#ifdef HOST_HAVE_OPENSSL
+                if (ssl) {
+                    n = SSL_read(ssl, buffer, sizeof(buffer));
+                    if (n <= 0) {
+                        int error = SSL_get_error(ssl, n);
+                        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) closed = true;
+                        return;
+                    }
+                    received.insert(received.end(), buffer, buffer + n);
+                    continue;
+                }
+#endif
+                n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    received.insert(received.end(), buffer, buffer + n);
+                } else {
+                    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) closed = true;
+                    return;
+                }
+            }
+        }
+};
+
+
+static HostConnection* socket_open_connection(const char* host, uint16_t port, BearSSL::WiFiClientSecure* tls){
+    (void)port;
+    unsigned long deadline = millis() + host_socket.connect_timeout_ms;
+    int fd = connect_socket(deadline);
+    SSL* ssl = nullptr;
+    if (fd >= 0 && tls) {
+        ssl = start_tls(fd, host, *tls, deadline);
+        if (ssl == nullptr) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        host_socket_stats.failed++;
+        return nullptr;
+    }
+    host_socket_stats.connections++;
+    return new SocketConnection(fd, ssl);
+}
+
+
+void host_socket_start(){
+    host_open_connection = socket_open_connection;
+}
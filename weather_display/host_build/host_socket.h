@@ -0,0 +1,38 @@
+//------------------------------------------------------------------------------------
+// Host (Linux) build: real network connections
+//
+// Sends the sketch's connections to a real server (e.g. mock_server.py) instead of
+// the simulated one. Whatever host and port the sketch asks for, the connection
+// goes to host_socket.address:host_socket.port, so the sketch doesn't need to be
+// changed. WiFiClientSecure connections use OpenSSL, set up to behave like BearSSL
+// on the board: TLS 1.2 only, sessions resumed by session ID (no tickets), and the
+// certificate only checked against the fingerprint (if one is set).
+//
+// The clock has to follow real time for this (host_use_real_time()).
+//------------------------------------------------------------------------------------
+#pragma once
+
+#include "host_hal.h"
+#include <string>
+
+struct HostSocketConfig {
+    std::string address = "127.0.0.1";
+    uint16_t port = 0;
+    unsigned long connect_timeout_ms = 5000;   // For the TCP connect and the TLS handshake
+};
+extern HostSocketConfig host_socket;
+
+struct HostSocketStats {
+    unsigned long connections = 0;        // Connections that worked
+    unsigned long failed = 0;             // Refused, timed out, or a failed TLS handshake
+    unsigned long tls_handshakes = 0;     // Full TLS handshakes
+    unsigned long tls_resumed = 0;        // Resumed TLS sessions
+    std::string last_error;               // Why the last connection failed
+};
+extern HostSocketStats host_socket_stats;
+
+// Send the sketch's network connections to host_socket.address:host_socket.port
+void host_socket_start();
+
+// True if this build can make TLS connections (it was built with OpenSSL)
+bool host_socket_has_tls();
@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+# ------------------------------------------------------------------------------------
+# Weather Display: a mock Open-Meteo server for testing the fetch code
+#
+# Answers every request with a saved reply (payloads/), over plain HTTP or HTTPS,
+# and can misbehave in all the ways a real server or a bad link can: answer late,
+# send slowly, stop half way, send too much, or not answer at all. fetch_test uses
+# it to check how the sketch handles each of them.
+#
+#    mock_server.py [options]
+#      --port N             Port to listen on (default 0: any free port)
+#      --tls CERT           Use HTTPS with this certificate (and CERT.key). They are
+#                           made with the openssl command if they don't exist yet.
+#      --payload FILE       The body to send (default payloads/one_location.json)
+#      --status CODE        The HTTP status code (default 200; errors get an error body)
+#      --etag               Send an ETag, and answer "304 Not Modified" when it comes back
+#      --latency MS         Wait this long before answering
+#      --jitter MS          ... plus a random time of up to this
+#      --chunked SIZE       Send the body in chunks of SIZE bytes (even to HTTP/1.0 requests)
+#      --throttle BYTES     Send at most this many bytes per second
+#      --pad N              Put N spaces in front of the body (still valid JSON)
+#      --truncate N         Close the connection after N bytes of the body
+#      --stall-after N      Stop sending after N bytes of the body, but keep the connection open
+#      --stall              Accept connections but never answer (no TLS handshake either)
+#      --verbose            Print one line per request to stderr
+#
+# The port is printed on the first line of stdout once the server is ready.
+# ------------------------------------------------------------------------------------
+import argparse
+import email.utils
+import os
+import random
+import socket
+import socketserver
+import ssl
+import subprocess
+import sys
+import time
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+HOLD_SECONDS = 60       # How long a stalled connection is kept open (if the client doesn't close it)
+SLICE_SECONDS = 0.02    # Throttled data is sent this often
+
+REASONS = {
+    200: "OK", 304: "Not Modified", 400: "Bad Request", 404: "Not Found",
+    429: "Too Many Requests", 500: "Internal Server Error", 502: "Bad Gateway",
+    503: "Service Unavailable", 504: "Gateway Timeout",
+}
+
+
+def make_certificate(cert, key):
+    # A self-signed certificate with the server's name. EC keys keep the handshake quick.
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:prime256v1",
+                    "-nodes", "-days", "3650", "-subj", "/CN=api.open-meteo.com",
+                    "-keyout", key, "-out", cert],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def read_request(connection):
+    # Everything up to the empty line after the headers
+    request = b""
+    while b"\r\n\r\n" not in request:
+        data = connection.recv(4096)
+        if not data:
+            return None
+        request += data
+    return request.decode("latin-1")
+
+
+def request_header(request, name):
+    for line in request.split("\r\n")[1:]:
+        key, _, value = line.partition(":")
+        if key.strip().lower() == name.lower():
+            return value.strip()
+    return ""
+
+
+def wait_for_close(connection):
+    # Say nothing until the client gives up (or we do)
+    connection.settimeout(HOLD_SECONDS)
+    try:
+        while connection.recv(4096):
+            pass
+    except (OSError, ssl.SSLError):
+        pass
+
+
+class Handler(socketserver.BaseRequestHandler):
+    def handle(self):
+        options = self.server.options
+        connection = self.request
+        connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)   # Don't hold back the last small packet
+        if options.stall:
+            wait_for_close(connection)
+            return
+        connection.settimeout(10)
+        try:
+            if self.server.tls_context:
+                connection = self.server.tls_context.wrap_socket(connection, server_side=True)
+            request = read_request(connection)
+            if request:
+                self.reply(connection, request)
+        except (OSError, ssl.SSLError) as error:
+            if options.verbose:
+                print("connection error:", error, file=sys.stderr)
+        finally:
+            if isinstance(connection, ssl.SSLSocket):
+                # A session is only kept for resuming if the connection was closed properly
+                try:
+                    connection.unwrap()
+                except (OSError, ssl.SSLError, ValueError):
+                    pass
+
+    def reply(self, connection, request):
+        options = self.server.options
+        request_line = request.split("\r\n", 1)[0]
+        etag = '"%s"' % self.server.etag
+        code = options.status
+        body = self.server.payload
+        if code == 200 and options.etag and request_header(request, "If-None-Match") == etag:
+            code = 304
+        if code == 304:
+            body = b""
+        elif code != 200:
+            body = b'{"error":true,"reason":"%s"}' % REASONS.get(code, "Error").encode()
+        if options.verbose:
+            print("%s -> %d" % (request_line, code), file=sys.stderr)
+
+        time.sleep((options.latency + random.uniform(0, options.jitter)) / 1000)
+
+        headers = ["HTTP/1.1 %d %s" % (code, REASONS.get(code, "Error")),
+                   "Date: " + email.utils.formatdate(usegmt=True),
+                   "Content-Type: " + self.server.content_type]
+        if options.etag:
+            headers.append("ETag: " + etag)
+        body = b" " * options.pad + body if body else body
+        if options.chunked and body:
+            headers.append("Transfer-Encoding: chunked")
+            size = options.chunked
+            body = b"".join(b"%x\r\n%s\r\n" % (len(body[i:i + size]), body[i:i + size])
+                            for i in range(0, len(body), size)) + b"0\r\n\r\n"
+        elif code != 304:
+            headers.append("Content-Length: %d" % len(body))
+        headers.append("Connection: close")
+        connection.sendall(("\r\n".join(headers) + "\r\n\r\n").encode())
+
+        stop_at = len(body)
+        if options.truncate is not None:
+            stop_at = min(stop_at, options.truncate)
+        if options.stall_after is not None:
+            stop_at = min(stop_at, options.stall_after)
+        self.send_body(connection, body[:stop_at])
+        if options.stall_after is not None:
+            wait_for_close(connection)
+
+    def send_body(self, connection, body):
+        throttle = self.server.options.throttle
+        if not throttle:
+            connection.sendall(body)
+            return
+        size = max(1, int(throttle * SLICE_SECONDS))
+        next_time = time.monotonic()
+        for start in range(0, len(body), size):
+            time.sleep(max(0, next_time - time.monotonic()))
+            connection.sendall(body[start:start + size])
+            next_time += size / throttle
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Mock Open-Meteo server for testing the weather display")
+    parser.add_argument("--port", type=int, default=0)
+    parser.add_argument("--tls", metavar="CERT")
+    parser.add_argument("--payload", default=os.path.join(HERE, "payloads", "one_location.json"))
+    parser.add_argument("--status", type=int, default=200)
+    parser.add_argument("--etag", action="store_true")
+    parser.add_argument("--latency", type=float, default=0)
+    parser.add_argument("--jitter", type=float, default=0)
+    parser.add_argument("--chunked", type=int, metavar="SIZE", default=0)
+    parser.add_argument("--throttle", type=float, metavar="BYTES", default=0)
+    parser.add_argument("--pad", type=int, default=0)
+    parser.add_argument("--truncate", type=int)
+    parser.add_argument("--stall-after", type=int)
+    parser.add_argument("--stall", action="store_true")
+    parser.add_argument("--verbose", action="store_true")
+    options = parser.parse_args()
+
+    payload = options.payload
+    if not os.path.exists(payload):
+        payload = os.path.join(HERE, "payloads", payload)   # Just the name of one of ours
+    server = Server(("127.0.0.1", options.port), Handler)
+    server.options = options
+    with open(payload, "rb") as file:
+        server.payload = file.read()
+    server.content_type = "text/html" if payload.endswith(".html") else "application/json; charset=utf-8"
+    server.etag = "%08x" % zlib.crc32(server.payload)
+    server.tls_context = None
+    if options.tls:
+        key = options.tls + ".key"
+        if not (os.path.exists(options.tls) and os.path.exists(key)):
+            make_certificate(options.tls, key)
+        # Like api.open-meteo.com for the board: TLS 1.2, sessions resumed by their ID
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.minimum_version = ssl.TLSVersion.TLSv1_2
+        context.maximum_version = ssl.TLSVersion.TLSv1_2
+        context.options |= ssl.OP_NO_TICKET
+        context.load_cert_chain(options.tls, key)
+        server.tls_context = context
+
+    print(server.server_address[1], flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,215 @@
+//------------------------------------------------------------------------------------
+// Weather Display: the recorded payloads, parsed the new way and the old way
+//
+// Serves every payload in host_build/payloads (as a plain "200 OK" reply) to the
+// sketch's own fetch_and_display_weather(), which parses it straight from the
+// stream with the JSON filter, one location at a time. Then it parses the same reply
+// the way versions before 1.6 did: the whole body is read into a String first, and
+// deserializeJson() keeps every value of it. The values stored from both must be the
+// same.
+//
+// For each payload it prints the body bytes read and kept in RAM, the JSON memory
+// used, and the most heap held while parsing (counted like simulate_week does, so it
+// includes what the host stand-ins allocate). The stream must need less memory than
+// the String.
+//
+//    parse_test [--serial]
+//
+// The exit code is 1 if a payload gave different values, or the stream didn't save
+// memory.
+//------------------------------------------------------------------------------------
+#include "host_hal.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// The sketch itself, so its fetch code and statistics can be used directly
+#include WEATHER_SKETCH
+
+#define PAYLOAD_FOLDER PAYLOADS "/"
+#define STRING_DOCUMENT_SIZE 16384   // Room for a whole payload without the filter
+
+const char* payload_names[] = { "one_location.json", "two_locations.json" };
+
+// The reply the next connection gets (made before the heap is counted, like the data
+// that is still in the network)
+static std::string reply;
+
+
+// A connection that gets the whole reply at once
+class PayloadConnection : public HostConnection {
+    public:
+        int available() override { return reply.size() - position; }
+        int read() override { return position < reply.size() ? (unsigned char)reply[position++] : -1; }
+        int peek() override { return position < reply.size() ? (unsigned char)reply[position] : -1; }
+        size_t write(const uint8_t* buffer, size_t size) override { (void)buffer; return size; }
+        bool connected() override { return position < reply.size(); }
+
+    private:
+        size_t position = 0;
+};
+
+
+static HostConnection* open_payload_connection(const char* host, uint16_t port, BearSSL::WiFiClientSecure* tls){
+    (void)host;
+    (void)port;
+    (void)tls;
+    return new PayloadConnection();
+}
+
+
+// How one way of parsing went
+struct ParseRun {
+    bool ok;
+    size_t bytes_read;            // Body bytes read from the connection
+    size_t bytes_kept;            // Body bytes held in RAM at once
+    size_t json_memory;           // JSON memory used
+    size_t heap_peak;             // The most heap held (above what was held before)
+};
+
+
+// What the sketch keeps from a payload
+struct StoredWeather {
+    WeatherSample weather[LOCATION_COUNT];
+    WeatherSample forecast[LOCATION_COUNT][FORECAST_HOURS];
+    int forecast_count;
+    uint32_t forecast_start;
+    uint32_t api_time;
+    uint32_t api_interval;
+};
+
+
+static StoredWeather stored_weather(){
+    StoredWeather stored;
+    memcpy(stored.weather, location_weather, sizeof(stored.weather));
+    memcpy(stored.forecast, forecast, sizeof(stored.forecast));
+    stored.forecast_count = forecast_count;
+    stored.forecast_start = forecast_start;
+    stored.api_time = api_time;
+    stored.api_interval = api_interval;
+    return stored;
+}
+
+
+static void forget_weather(){
+    memset(location_weather, 0, sizeof(location_weather));
+    memset(forecast, 0, sizeof(forecast));
+    forecast_count = 0;
+    forecast_start = 0;
+    api_time = 0;
+    api_interval = 0;
+}
+
+
+// The new way: the sketch's own fetch code
+static ParseRun parse_from_stream(){
+    size_t heap_before = host_heap_used;
+    host_heap_peak = heap_before;
+    host_count_heap = true;
+    FailureKind result = fetch_and_display_weather();
+    host_count_heap = false;
+    return { result == FAILURE_NONE, bytes_parsed, 0, json_memory_used, host_heap_peak - heap_before };
+}
+
+
+// The old way (version 1.5): the whole body into a String, then parse all of it
+static ParseRun parse_from_string(){
+    static StaticJsonDocument<STRING_DOCUMENT_SIZE> doc;
+    size_t heap_before = host_heap_used;
+    host_heap_peak = heap_before;
+    host_count_heap = true;
+
+    ParseRun run = { false, 0, 0, 0, 0 };
+    WiFiClient client;
+    HTTPClient http;
+    if (http.begin(client, server_host, SERVER_PORT, server_path) && http.GET() == HTTP_CODE_OK) {
+        String payload;
+        WiFiClient& stream = http.getStream();
+        while (stream.connected() || stream.available() > 0) {
+            int c = stream.read();
+            if (c < 0) break;
+            payload += (char)c;
+        }
+        run.bytes_read = run.bytes_kept = strlen(payload.c_str());
+
+        DeserializationError error = deserializeJson(doc, payload.c_str());
+        if (!error) {
+            start_fetched_weather();
+            JsonArray list = doc.as<JsonArray>();   // Null with only one location
+            int count = list.isNull() ? 1 : min((int)list.size(), LOCATION_COUNT);
+            for (int location = 0; location < count; location++) {
+                JsonObject object = list.isNull() ? doc.as<JsonObject>() : list[location].as<JsonObject>();
+                store_location(object, location);
+            }
+            use_fetched_weather();
+            run.ok = count == LOCATION_COUNT;
+        }
+        run.json_memory = doc.memoryUsage();
+    }
+    http.end();
+
+    host_count_heap = false;
+    run.heap_peak = host_heap_peak - heap_before;
+    return run;
+}
+
+
+int main(int argc, char** argv){
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serial") == 0) {
+            host_serial_echo = true;
+        } else {
+            fprintf(stderr, "usage: parse_test [--serial]\n");
+            return 2;
+        }
+    }
+
+    setup();   // Builds the request path (and the screens the fetch draws on)
+    host_open_connection = open_payload_connection;
+    host_wifi.connect_ms = 0;
+    WiFi.forceSleepWake();
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+
+    printf("%-20s %7s  %-29s  %-29s\n", "", "", "stream + filter", "String (version 1.5)");
+    printf("%-20s %7s  %6s %6s %6s %8s  %6s %6s %6s %8s\n", "payload", "body",
+           "read", "kept", "JSON", "heap", "read", "kept", "JSON", "heap");
+    int problems = 0;
+    for (const char* name : payload_names) {
+        std::ifstream file(PAYLOAD_FOLDER + std::string(name), std::ios::binary);
+        std::stringstream body;
+        body << file.rdbuf();
+        if (!file || body.str().empty()) {
+            printf("%-20s couldn't be read\n", name);
+            problems++;
+            continue;
+        }
+        reply = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+              + std::to_string(body.str().size()) + "\r\nConnection: close\r\n\r\n" + body.str();
+
+        forget_weather();
+        ParseRun streamed = parse_from_stream();
+        StoredWeather from_stream = stored_weather();
+        forget_weather();
+        ParseRun from_string_run = parse_from_string();
+        StoredWeather from_string = stored_weather();
+
+        printf("%-20s %7zu  %6zu %6zu %6zu %8zu  %6zu %6zu %6zu %8zu\n", name, body.str().size(),
+               streamed.bytes_read, streamed.bytes_kept, streamed.json_memory, streamed.heap_peak,
+               from_string_run.bytes_read, from_string_run.bytes_kept, from_string_run.json_memory,
+               from_string_run.heap_peak);
+
+        if (!streamed.ok || !from_string_run.ok) {
+            printf("%-20s couldn't be parsed (%s)\n", name, streamed.ok ? "String" : "stream");
+            problems++;
+        } else if (memcmp(&from_stream, &from_string, sizeof(from_stream)) != 0) {
+            printf("%-20s gave different values from the stream and from the String\n", name);
+            problems++;
+        } else if (streamed.bytes_kept + streamed.json_memory >= from_string_run.bytes_kept + from_string_run.json_memory
+                   || streamed.heap_peak >= from_string_run.heap_peak) {
+            printf("%-20s needed no less memory from the stream than from the String\n", name);
+            problems++;
+        }
+    }
+    return problems > 0 ? 1 : 0;
+}
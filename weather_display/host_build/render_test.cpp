@@ -0,0 +1,106 @@
+//------------------------------------------------------------------------------------
+// Weather Display: the two ways of drawing the weather screen, compared
+//
+// The sketch draws the weather screens from prebuilt layouts with its own number
+// formatter (USE_PREBUILT_LAYOUTS), or the old way with printf and floats. Both must
+// put exactly the same pixels on the screen. This draws both, at text sizes 1 and 2
+// and for every location, over a sweep of values (negative temperatures, halves
+// that have to be rounded, 4 and 5 digit pressures, ...) and compares the screen
+// buffers byte by byte. It also prints how long each way took.
+//
+//    render_test [--serial]
+//
+// The exit code is 1 if any screen was different.
+//------------------------------------------------------------------------------------
+#include "host_hal.h"
+#include <chrono>
+
+// The sketch itself, so both drawing functions can be called directly
+#include WEATHER_SKETCH
+
+#define SWEEP_STEPS 2001          // Sets of values drawn (humidity goes 0.0 to 100.0 %)
+#define SHOWN_MISMATCHES 5        // How many different screens are printed in full
+
+using render_clock = std::chrono::steady_clock;
+
+
+// The values of one step of the sweep (in tenths), each going through its own range.
+// The large screen only has room for 4 characters, so temperatures stay within
+// -9.9 to 44.9 C (with more, printf wraps to the next line and the layouts don't).
+static void set_sweep_values(int step){
+    weather.temp_c = step % 549 - 99;             // -9.9 to 44.9 C
+    weather.feels_like_c = 449 - step % 549;      // 44.9 to -9.9 C
+    weather.humidity_percent = step % 1001;       // Every tenth from 0.0 to 100.0 %
+    weather.pressure_hpa = 9400 + step * 3;       // 940.0 to 1540.0 hPa
+    weather.wind_speed_mps = step % 500;          // 0.0 to 49.9 m/s
+    weather.cloud_cover_percent = step * 7 % 1001;
+}
+
+
+// Print where two screens are different (the first and last differing byte)
+static void print_mismatch(int text_size, int location, const uint8_t* expected){
+    const uint8_t* frame = display.getBuffer();
+    int first = -1;
+    int last = -1;
+    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT / 8; i++) {
+        if (frame[i] == expected[i]) continue;
+        if (first < 0) first = i;
+        last = i;
+    }
+    printf("Text size %d, location %d: temp %d, feels %d, hum %d, press %d, wind %d, cloud %d (tenths):"
+           " different from page %d column %d to page %d column %d\n",
+           text_size, location + 1, weather.temp_c, weather.feels_like_c, weather.humidity_percent,
+           weather.pressure_hpa, weather.wind_speed_mps, weather.cloud_cover_percent,
+           first / SCREEN_WIDTH, first % SCREEN_WIDTH, last / SCREEN_WIDTH, last % SCREEN_WIDTH);
+}
+
+
+int main(int argc, char** argv){
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serial") == 0) {
+            host_serial_echo = true;
+        } else {
+            fprintf(stderr, "usage: render_test [--serial]\n");
+            return 2;
+        }
+    }
+
+    setup();   // Builds the glyph cache and the prebuilt layouts
+    strcpy(formattedTime, "12:34");
+
+    static uint8_t printf_screen[SCREEN_WIDTH * SCREEN_HEIGHT / 8];
+    double layout_us = 0;
+    double printf_us = 0;
+    unsigned long screens = 0;
+    unsigned long mismatches = 0;
+    for (int step = 0; step < SWEEP_STEPS; step++) {
+        set_sweep_values(step);
+        for (int location = 0; location < LOCATION_COUNT; location++) {
+            selected_location = location;
+            for (int text_size = 1; text_size <= 2; text_size++) {
+                user_selected_text_size = text_size;
+
+                render_clock::time_point start = render_clock::now();
+                draw_weather_printf();
+                render_clock::time_point middle = render_clock::now();
+                memcpy(printf_screen, display.getBuffer(), sizeof(printf_screen));
+                render_clock::time_point layout_start = render_clock::now();
+                draw_weather_layouts();
+                render_clock::time_point end = render_clock::now();
+                printf_us += std::chrono::duration<double, std::micro>(middle - start).count();
+                layout_us += std::chrono::duration<double, std::micro>(end - layout_start).count();
+
+                screens++;
+                if (memcmp(display.getBuffer(), printf_screen, sizeof(printf_screen)) != 0) {
+                    if (mismatches < SHOWN_MISMATCHES) print_mismatch(text_size, location, printf_screen);
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    printf("Compared %lu screens: %lu different\n", screens, mismatches);
+    printf("Drawing took %.2f us per screen with the prebuilt layouts, %.2f us with printf\n",
+           layout_us / screens, printf_us / screens);
+    return mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,381 @@
+//------------------------------------------------------------------------------------
+// Host (Linux) build: a simulated Open-Meteo server
+//------------------------------------------------------------------------------------
+#include "sim_server.h"
+
+#include <WiFiClientSecure.h>
+#include <functional>
+#include <set>
+#include <time.h>
+
+SimServerConfig sim_server;
+SimServerStats sim_server_stats;
+
+static const double TWO_PI = 6.283185307179586;
+static const long UTC_OFFSET = 9 * 3600;   // The weather follows the day in Japan
+
+
+// The values Open-Meteo knows about (only these can be asked for)
+struct SimField {
+    const char* name;
+    const char* unit;
+    int decimals;
+};
+static const SimField sim_fields[] = {
+    { "temperature_2m",       "\xC2\xB0" "C", 1 },
+    { "apparent_temperature", "\xC2\xB0" "C", 1 },
+    { "relative_humidity_2m", "%",            0 },
+    { "surface_pressure",     "hPa",          1 },
+    { "wind_speed_10m",       "km/h",         1 },
+    { "wind_direction_10m",   "\xC2\xB0",     0 },
+    { "cloud_cover",          "%",            0 },
+    { "precipitation",        "mm",           1 },
+};
+
+
+static const SimField* find_field(const std::string& name){
+    for (const SimField& field : sim_fields) {
+        if (name == field.name) return &field;
+    }
+    return nullptr;
+}
+
+
+// The made-up weather of a location at a (unix) time
+static double sim_weather(const std::string& field, uint32_t time, int location){
+    double days = (double)(time - host_start_unix_time) / 86400;
+    double hour = (double)((time + UTC_OFFSET) % 86400) / 3600;
+    double daily = sin(TWO_PI * (hour - 9) / 24);      // Warmest in the afternoon
+    double front = tanh((days - 3.5) * 12);             // A front comes through half way into day 4
+
+    if (field == "temperature_2m" || field == "apparent_temperature") {
+        double temp = 18 + 1.5 * location + 4.5 * daily + 3 * sin(TWO_PI * days / 5.3) - 2 * front;
+        if (field == "apparent_temperature") temp -= 1.5 - 0.8 * sin(TWO_PI * days * 1.3);
+        return temp;
+    }
+    if (field == "relative_humidity_2m") return 70 - 12 * daily + 8 * sin(TWO_PI * days / 3.1);
+    if (field == "surface_pressure") return 1010 - 3 * location + 5 * sin(TWO_PI * days / 4.2) - 6 * front
+                                            + 0.8 * sin(TWO_PI * hour / 12);
+    if (field == "wind_speed_10m") return 9 + 5 * sin(TWO_PI * days / 2.3) + 3 * daily + 8 * (1 - front * front);
+    if (field == "wind_direction_10m") return fmod(200 + 80 * sin(TWO_PI * days / 3.7) + 360, 360);
+    if (field == "cloud_cover") return constrain(50 + 45 * sin(TWO_PI * days / 2.9), 0.0, 100.0);
+    if (field == "precipitation") return max(0.0, 2 * sin(TWO_PI * days / 2.9) - 1.2);
+    return 0;
+}
+
+
+double sim_server_weather(const std::string& field, uint32_t time, int location){
+    return sim_weather(field, time, location);
+}
+
+
+static std::vector<std::string> split(const std::string& text, char separator){
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(separator, start);
+        if (end == std::string::npos) end = text.size();
+        if (end > start) parts.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return parts;
+}
+
+
+// Undo the %XX escapes of a URL
+static std::string url_decode(const std::string& text){
+    std::string result;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '%' && i + 2 < text.size() && isxdigit(text[i + 1]) && isxdigit(text[i + 2])) {
+            result += (char)strtol(text.substr(i + 1, 2).c_str(), nullptr, 16);
+            i += 2;
+        } else {
+            result += text[i];
+        }
+    }
+    return result;
+}
+
+
+// A time as Open-Meteo writes it: a unix time, or a local ISO 8601 time in quotes
+static std::string format_time(uint32_t time, bool unix_time){
+    if (unix_time) return std::to_string(time);
+    time_t local = time + UTC_OFFSET;
+    struct tm parts;
+    gmtime_r(&local, &parts);
+    char text[24];
+    strftime(text, sizeof(text), "\"%Y-%m-%dT%H:%M\"", &parts);
+    return text;
+}
+
+
+static std::string format_value(const SimField& field, double value){
+    char text[32];
+    snprintf(text, sizeof(text), "%.*f", field.decimals, value);
+    return text;
+}
+
+
+// The HTTP "Date" header of a (unix) time, like "Mon, 12 Oct 2026 00:00:00 GMT"
+static std::string http_date(uint32_t time){
+    static const char* days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char* months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    time_t t = time;
+    struct tm parts;
+    gmtime_r(&t, &parts);
+    char text[40];
+    snprintf(text, sizeof(text), "%s, %02d %s %04d %02d:%02d:%02d GMT", days[parts.tm_wday], parts.tm_mday,
+             months[parts.tm_mon], parts.tm_year + 1900, parts.tm_hour, parts.tm_min, parts.tm_sec);
+    return text;
+}
+
+
+// Everything the request asked for
+struct SimRequest {
+    std::vector<std::string> latitudes;
+    std::vector<std::string> longitudes;
+    std::vector<std::string> current;
+    std::vector<std::string> hourly;
+    int forecast_hours = 168;
+    bool unix_time = false;
+    std::string error;      // Why the request is bad ("" if it is fine)
+};
+
+
+static SimRequest parse_query(const std::string& path){
+    SimRequest request;
+    size_t question = path.find('?');
+    if (path.compare(0, question, "/v1/forecast") != 0) {
+        request.error = "Not Found";
+        return request;
+    }
+    for (const std::string& parameter : split(question == std::string::npos ? "" : path.substr(question + 1), '&')) {
+        size_t equals = parameter.find('=');
+        std::string name = parameter.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : url_decode(parameter.substr(equals + 1));
+        if (name == "latitude") request.latitudes = split(value, ',');
+        else if (name == "longitude") request.longitudes = split(value, ',');
+        else if (name == "current") request.current = split(value, ',');
+        else if (name == "hourly") request.hourly = split(value, ',');
+        else if (name == "forecast_hours") request.forecast_hours = atoi(value.c_str());
+        else if (name == "timeformat") request.unix_time = value == "unixtime";
+    }
+
+    if (request.latitudes.empty() || request.latitudes.size() != request.longitudes.size()) {
+        request.error = "Parameter 'latitude' and 'longitude' must have the same number of elements";
+    }
+    for (const std::vector<std::string>* names : { &request.current, &request.hourly }) {
+        for (const std::string& name : *names) {
+            if (!find_field(name)) request.error = "Cannot initialize ForecastVariable from invalid String value " + name;
+        }
+    }
+    return request;
+}
+
+
+// One location's part of the reply (the same layout as Open-Meteo's)
+static std::string location_json(const SimRequest& request, int location, uint32_t now){
+    uint32_t current_time = now - now % sim_server.update_interval;
+    std::string json = "{\"latitude\":" + request.latitudes[location] + ",\"longitude\":" + request.longitudes[location]
+                     + ",\"generationtime_ms\":0.0560283660888672,\"utc_offset_seconds\":32400"
+                     + ",\"timezone\":\"Asia/Tokyo\",\"timezone_abbreviation\":\"GMT+9\",\"elevation\":21.0";
+
+    if (!request.current.empty()) {
+        json += ",\"current_units\":{\"time\":\"" + std::string(request.unix_time ? "unixtime" : "iso8601")
+              + "\",\"interval\":\"seconds\"";
+        for (const std::string& name : request.current) json += ",\"" + name + "\":\"" + find_field(name)->unit + "\"";
+        json += "},\"current\":{\"time\":" + format_time(current_time, request.unix_time)
+              + ",\"interval\":" + std::to_string(sim_server.update_interval);
+        for (const std::string& name : request.current) {
+            json += ",\"" + name + "\":" + format_value(*find_field(name), sim_weather(name, current_time, location));
+        }
+        json += "}";
+    }
+
+    if (!request.hourly.empty()) {
+        uint32_t first_hour = now - now % 3600;
+        json += ",\"hourly_units\":{\"time\":\"" + std::string(request.unix_time ? "unixtime" : "iso8601") + "\"";
+        for (const std::string& name : request.hourly) json += ",\"" + name + "\":\"" + find_field(name)->unit + "\"";
+        json += "},\"hourly\":{\"time\":[";
+        for (int hour = 0; hour < request.forecast_hours; hour++) {
+            json += (hour > 0 ? "," : "") + format_time(first_hour + hour * 3600, request.unix_time);
+        }
+        json += "]";
+        for (const std::string& name : request.hourly) {
+            json += ",\"" + name + "\":[";
+            for (int hour = 0; hour < request.forecast_hours; hour++) {
+                json += (hour > 0 ? "," : "") + format_value(*find_field(name), sim_weather(name, first_hour + hour * 3600, location));
+            }
+            json += "]";
+        }
+        json += "}";
+    }
+    return json + "}";
+}
+
+
+// The value of a request header ("" if it isn't there)
+static std::string request_header(const std::string& request, const char* name){
+    for (const std::string& line : split(request, '\n')) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || strncasecmp(line.c_str(), name, colon) != 0 || strlen(name) != colon) continue;
+        size_t start = line.find_first_not_of(' ', colon + 1);
+        size_t end = line.find_last_not_of("\r ");
+        return start == std::string::npos ? "" : line.substr(start, end - start + 1);
+    }
+    return "";
+}
+
+
+std::string sim_server_reply(const std::string& request){
+    sim_server_stats.requests++;
+    uint32_t now = host_unix_time();
+    std::string method, path, version;
+    size_t first_space = request.find(' ');
+    size_t second_space = request.find(' ', first_space + 1);
+    size_t line_end = request.find("\r\n");
+    if (first_space != std::string::npos && second_space != std::string::npos && line_end != std::string::npos) {
+        method = request.substr(0, first_space);
+        path = request.substr(first_space + 1, second_space - first_space - 1);
+        version = request.substr(second_space + 1, line_end - second_space - 1);
+    }
+
+    int code = 200;
+    const char* status = "OK";
+    std::string body;
+    std::string extra_headers;
+    SimRequest query = parse_query(path);
+
+    if (host_in_outage(sim_server.outages, host_elapsed_us() / 1000)) {
+        code = 503;
+        status = "Service Unavailable";
+        body = "{\"error\":true,\"reason\":\"Service temporarily unavailable\"}";
+    } else if (method != "GET" || !query.error.empty()) {
+        code = query.error == "Not Found" ? 404 : 400;
+        status = code == 404 ? "Not Found" : "Bad Request";
+        body = "{\"error\":true,\"reason\":\"" + (query.error.empty() ? std::string("Bad request") : query.error) + "\"}";
+    } else {
+        // The ETag changes whenever the current weather does
+        uint32_t current_time = now - now % sim_server.update_interval;
+        std::string etag = "\"" + std::to_string(current_time) + "-" + std::to_string(std::hash<std::string>()(path) % 100000) + "\"";
+        if (sim_server.send_etag) extra_headers += "ETag: " + etag + "\r\n";
+
+        if (sim_server.send_etag && request_header(request, "If-None-Match") == etag) {
+            code = 304;
+            status = "Not Modified";
+        } else if (query.latitudes.size() == 1) {
+            body = location_json(query, 0, now);
+        } else {
+            body = "[";
+            for (size_t i = 0; i < query.latitudes.size(); i++) body += (i > 0 ? "," : "") + location_json(query, i, now);
+            body += "]";
+        }
+    }
+
+    if (code == 200) sim_server_stats.full_replies++;
+    else if (code == 304) sim_server_stats.not_modified++;
+    else sim_server_stats.errors++;
+    sim_server_stats.body_bytes += body.size();
+
+    std::string reply = "HTTP/1.1 " + std::to_string(code) + " " + status + "\r\n"
+                      + "Date: " + http_date(now) + "\r\n"
+                      + "Content-Type: application/json; charset=utf-8\r\n"
+                      + extra_headers;
+    if (code == 304) return reply + "Connection: close\r\n\r\n";
+
+    if (sim_server.chunked && version == "HTTP/1.1") {
+        reply += "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+        for (size_t start = 0; start < body.size(); start += 512) {
+            size_t length = min((size_t)512, body.size() - start);
+            char size_line[16];
+            snprintf(size_line, sizeof(size_line), "%zx\r\n", length);
+            reply += size_line + body.substr(start, length) + "\r\n";
+        }
+        return reply + "0\r\n\r\n";
+    }
+    return reply + "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+}
+
+
+// A connection to the simulated server. The reply arrives bit by bit, as the virtual
+// clock moves on (the sketch waits for it with delay(), like on the board).
+class SimConnection : public HostConnection {
+    public:
+        explicit SimConnection(bool tls) : tls(tls) {
+            if (tls) host_open_tls_connections++;
+        }
+        ~SimConnection() override {
+            if (tls) host_open_tls_connections--;
+        }
+
+        int available() override { return arrived() - position; }
+        int read() override { return available() > 0 ? (unsigned char)reply[position++] : -1; }
+        int peek() override { return available() > 0 ? (unsigned char)reply[position] : -1; }
+
+        size_t write(const uint8_t* buffer, size_t size) override {
+            if (replied) return 0;
+            request.append((const char*)buffer, size);
+            if (request.find("\r\n\r\n") != std::string::npos) {
+                reply = sim_server_reply(request);
+                first_byte_us = host_elapsed_us() + sim_server.response_ms * 1000ULL;
+                replied = true;
+            }
+            return size;
+        }
+
+        // The server closes the connection once the whole reply is sent
+        bool connected() override { return !replied || position < reply.size(); }
+
+    private:
+        bool tls;
+        std::string request;
+        std::string reply;
+        bool replied = false;
+        size_t position = 0;
+        uint64_t first_byte_us = 0;
+
+        // How many bytes of the reply have arrived by now
+        size_t arrived() {
+            if (!replied || host_elapsed_us() < first_byte_us) return position;
+            uint64_t count = 1 + (host_elapsed_us() - first_byte_us) * sim_server.bytes_per_ms / 1000;
+            return max((size_t)min(count, (uint64_t)reply.size()), position);
+        }
+};
+
+
+// Session IDs the server will resume
+static std::set<std::string> known_sessions;
+
+
+static HostConnection* sim_open_connection(const char* host, uint16_t port, BearSSL::WiFiClientSecure* tls){
+    (void)host;
+    (void)port;
+    host_advance_us(sim_server.connect_ms * 1000ULL);
+    if (tls) {
+        BearSSL::Session* session = tls->session;
+        std::string offered;
+        if (session && session->session_id_len > 0) offered.assign((const char*)session->session_id, session->session_id_len);
+        tls->session_resumed = known_sessions.count(offered) > 0;
+
+        if (tls->session_resumed) {
+            sim_server_stats.tls_resumed++;
+            host_advance_us(sim_server.tls_resume_ms * 1000ULL);
+        } else {
+            sim_server_stats.tls_handshakes++;
+            host_advance_us(sim_server.tls_handshake_ms * 1000ULL);
+            if (session) {   // A new session the client can offer next time
+                for (uint8_t& byte : session->session_id) byte = random(256);
+                session->session_id_len = sizeof(session->session_id);
+                session->version = 0x0303;          // TLS 1.2
+                session->cipher_suite = 0xC02F;     // ECDHE-RSA-AES128-GCM-SHA256
+                known_sessions.insert(std::string((const char*)session->session_id, session->session_id_len));
+            }
+        }
+    }
+    return new SimConnection(tls != nullptr);
+}
+
+
+void sim_server_start(){
+    host_open_connection = sim_open_connection;
+}
@@ -0,0 +1,48 @@
+//------------------------------------------------------------------------------------
+// Host (Linux) build: a simulated Open-Meteo server
+//
+// It runs inside the same program, on the virtual clock. It answers the sketch's
+// requests like api.open-meteo.com does (same JSON, same headers), with weather
+// made up from a few slow waves (a daily cycle, a front coming through, ...).
+// Connecting, the TLS handshake and the download take virtual time, so the
+// sketch's radio-on numbers come out close to the board's.
+//------------------------------------------------------------------------------------
+#pragma once
+
+#include "host_hal.h"
+#include <string>
+#include <vector>
+
+struct SimServerConfig {
+    unsigned long connect_ms = 80;          // DNS lookup and TCP connect
+    unsigned long tls_handshake_ms = 1600;  // Full TLS handshake (slow on the ESP8266)
+    unsigned long tls_resume_ms = 350;      // Resumed TLS session
+    unsigned long response_ms = 150;        // From the request to the first byte of the reply
+    unsigned long bytes_per_ms = 20;        // Download speed (about 160 kbit/s through BearSSL)
+    unsigned long update_interval = 900;    // Seconds between updates of the current weather
+    bool send_etag = false;                 // Open-Meteo doesn't send one, but the sketch can use it
+    bool chunked = false;                   // Send "chunked" bodies to HTTP/1.1 requests
+    std::vector<HostOutage> outages;        // When the server only answers "503 Service Unavailable"
+};
+extern SimServerConfig sim_server;
+
+struct SimServerStats {
+    unsigned long requests = 0;
+    unsigned long full_replies = 0;         // "200 OK" with weather data
+    unsigned long not_modified = 0;         // "304 Not Modified"
+    unsigned long errors = 0;               // Anything else
+    unsigned long tls_handshakes = 0;       // Full TLS handshakes
+    unsigned long tls_resumed = 0;          // Resumed TLS sessions
+    unsigned long long body_bytes = 0;      // Body bytes sent
+};
+extern SimServerStats sim_server_stats;
+
+// Send the sketch's network connections to the simulated server
+void sim_server_start();
+
+// The whole reply (headers and body) to a raw HTTP request, at the current virtual time
+std::string sim_server_reply(const std::string& request);
+
+// The true weather of a location at a (unix) time, in the units the server sends
+// (e.g. "temperature_2m" in C). The server's replies are made from it.
+double sim_server_weather(const std::string& field, uint32_t time, int location);
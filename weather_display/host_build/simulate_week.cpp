@@ -0,0 +1,441 @@
+//------------------------------------------------------------------------------------
+// Weather Display: a simulated week on Linux
+//
+// Runs the real sketch against the fake board (host_hal.cpp) and the simulated
+// Open-Meteo server (sim_server.cpp) on a virtual clock, so a week of loop() takes
+// well under a second. At the end it reports what the week cost: wall time per
+// fetch cycle, display flushes, bytes parsed and radio-on time. It also replays the
+// screen against the true weather of the simulated server, to show how far off the
+// display was for the number of fetches it made.
+//
+//    simulate_week [options]
+//      --days N                 How long to simulate (default 7)
+//      --button-every MINUTES   Press the Flash button this often (default never)
+//      --wifi-outage H:MINUTES  Switch the access point off at hour H, for MINUTES
+//      --server-outage H:MINUTES  Let the server answer "503" from hour H, for MINUTES
+//      --etag                   Let the server send an ETag (and answer "304 Not Modified")
+//      --clock-error PPM        Let the board's clock run this much too fast
+//      --vcc MV                 Battery voltage (default 3000)
+//      --reset-every HOURS      Reset the sketch this often (RAM is lost, RTC memory is kept)
+//      --csv FILE               Write one line per fetch cycle to FILE
+//      --serial                 Show the sketch's Serial output
+//      --expect-failures        Fail (exit code 1) unless some fetches failed
+//
+// The exit code is 1 if the sketch stopped (halt_program_execution(), or loop()
+// never returned), never finished a fetch cycle, or broke one of these checks:
+//  - the display was updated at least every REFRESH_INTERVAL minutes (plus the
+//    wait for the server's next update, when a fetch had to be put off)
+//  - the number of fetches fits MIN_FETCH_INTERVAL and MAX_FETCH_INTERVAL
+//  - the clock was never off by more than MAX_CLOCK_ERROR seconds
+//  - after every reset, RTC memory (checked by its CRC) brought everything back
+//  - every refresh came on time (light sleep never slept through one), and the
+//    sketch counted the same timer and button wakes as the board
+//  - no run of loop() kept the CPU busy for longer than LONGEST_LOOP_MS (the
+//    button is only read between runs)
+//  - the heap the sketch holds after a fetch cycle didn't grow from the first half of
+//    the run to the second (a leak). The heap is counted with a replaced operator new.
+//  - after every run of loop() that flushed the screen, the emulated display memory
+//    (what went over I2C) is the same as the screen buffer
+//  - the history has one sample every HISTORY_INTERVAL minutes since the first
+//    one (none missing or extra, also across resets), up to the end of the run
+//------------------------------------------------------------------------------------
+#include "host_hal.h"
+#include "sim_server.h"
+#include <chrono>
+
+// The sketch itself, so its statistics can be read directly
+#include WEATHER_SKETCH
+
+#define LOOP_COST_US 1000         // CPU time of one run of loop() (the sketch never waits for it)
+#define HALTED_AFTER_MS 86400000  // A loop() that doesn't return for a day has stopped
+#define TRUTH_SAMPLE_MS 60000     // How often the screen is compared with the true weather
+#define LONGEST_DISPLAY_GAP_MS ((REFRESH_INTERVAL * 60UL + 900 + SERVER_UPDATE_MARGIN) * 1000)
+#define MAX_REFRESH_DELAY_MS 1000  // How late a refresh may come (after its timer ran out)
+#define LONGEST_LOOP_MS 2500      // The HTTPS request step: a full TLS handshake and the reply
+#define HEAP_GROWTH_ALLOWED 0     // Bytes the heap may hold between fetches in the second half, more than the first
+
+using sim_clock = std::chrono::steady_clock;
+
+// One finished fetch cycle
+struct SimCycle {
+    uint64_t end_ms;              // Simulated time when it finished
+    double wall_ms;               // Real time it took to simulate (since the last cycle)
+    unsigned long cycle_ms;       // Simulated length of the cycle
+    unsigned long radio_on_ms;
+    unsigned long flushes;        // Display flushes since the last cycle
+    size_t bytes_parsed;          // 0 if no new data was read
+};
+
+// How far the displayed weather was from the true weather
+struct DisplayError {
+    double temp_sum = 0;          // Sum of the temperature errors (C)
+    double temp_max = 0;
+    double pressure_sum = 0;      // Sum of the pressure errors (hPa)
+    double pressure_max = 0;
+    unsigned long samples = 0;    // Number of (location, time) comparisons
+};
+
+
+// Compare what the sketch shows for every location with the true weather at a
+// (simulated) time
+static void compare_with_truth(DisplayError& error, uint64_t elapsed_ms){
+    double real_s = elapsed_ms / 1000.0 / (1.0 + host_clock_error_ppm / 1000000.0);
+    uint32_t time = host_start_unix_time + (uint32_t)real_s;
+    for (int location = 0; location < LOCATION_COUNT; location++) {
+        double temp = fabs(location_weather[location].temp_c / 10.0
+                           - sim_server_weather("temperature_2m", time, location));
+        double pressure = fabs(location_weather[location].pressure_hpa / 10.0
+                               - sim_server_weather("surface_pressure", time, location));
+        error.temp_sum += temp;
+        error.temp_max = max(error.temp_max, temp);
+        error.pressure_sum += pressure;
+        error.pressure_max = max(error.pressure_max, pressure);
+        error.samples++;
+    }
+}
+
+
+// Read "H:MINUTES" into an outage
+static bool parse_outage(const char* text, std::vector<HostOutage>& outages){
+    double hour;
+    double minutes;
+    if (sscanf(text, "%lf:%lf", &hour, &minutes) != 2) return false;
+    outages.push_back({ (uint64_t)(hour * 3600000), (uint64_t)(minutes * 60000) });
+    return true;
+}
+
+
+// Reset the sketch, like pressing RST: the RAM copies of what RTC memory keeps
+// (and the clock and forecast, which it doesn't) are wiped, and setup() runs again.
+// Returns true if load_rtc_data() brought everything back.
+static bool simulate_reset(){
+    RtcData saved_rtc_data = rtc_data;
+    WeatherSample saved_weather[LOCATION_COUNT];
+    memcpy(saved_weather, location_weather, sizeof(saved_weather));
+
+    memset(&rtc_data, 0xEE, sizeof(rtc_data));
+    memset(location_weather, 0, sizeof(location_weather));
+    memset(formattedTime, 0, sizeof(formattedTime));
+    tls_session = BearSSL::Session();
+    forecast_count = 0;
+    clock_is_set = false;
+
+    load_rtc_data();
+    bool restored = memcmp(&rtc_data, &saved_rtc_data, sizeof(rtc_data)) == 0
+                 && memcmp(location_weather, saved_weather, sizeof(saved_weather)) == 0;
+    host_count_heap = true;
+    setup();
+    host_count_heap = false;
+    return restored;
+}
+
+
+static void print_usage(){
+    fprintf(stderr, "usage: simulate_week [--days N] [--button-every MINUTES] [--wifi-outage H:MINUTES]\n"
+                    "                     [--server-outage H:MINUTES] [--etag] [--clock-error PPM] [--vcc MV]\n"
+                    "                     [--reset-every HOURS] [--csv FILE] [--serial] [--expect-failures]\n");
+}
+
+
+int main(int argc, char** argv){
+    double days = 7;
+    const char* csv_name = nullptr;
+    bool expect_failures = false;
+    uint64_t reset_every_ms = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool ok = true;
+        if (strcmp(option, "--serial") == 0) {
+            host_serial_echo = true;
+            continue;
+        } else if (strcmp(option, "--etag") == 0) {
+            sim_server.send_etag = true;
+            continue;
+        } else if (strcmp(option, "--expect-failures") == 0) {
+            expect_failures = true;
+            continue;
+        } else if (value == nullptr) {
+            ok = false;
+        } else if (strcmp(option, "--days") == 0) {
+            days = atof(value);
+        } else if (strcmp(option, "--button-every") == 0) {
+            host_button_period_ms = (uint64_t)(atof(value) * 60000);
+        } else if (strcmp(option, "--wifi-outage") == 0) {
+            ok = parse_outage(value, host_wifi.outages);
+        } else if (strcmp(option, "--server-outage") == 0) {
+            ok = parse_outage(value, sim_server.outages);
+        } else if (strcmp(option, "--clock-error") == 0) {
+            host_clock_error_ppm = atol(value);
+        } else if (strcmp(option, "--vcc") == 0) {
+            host_vcc_mv = atoi(value);
+        } else if (strcmp(option, "--reset-every") == 0) {
+            reset_every_ms = (uint64_t)(atof(value) * 3600000);
+        } else if (strcmp(option, "--csv") == 0) {
+            csv_name = value;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            print_usage();
+            return 2;
+        }
+        i++;
+    }
+
+    sim_server_start();
+    host_set_time_limit_ms((uint64_t)(days * 86400000));
+
+    std::vector<SimCycle> cycles;
+    unsigned long loops = 0;
+    unsigned long last_cycles = 0;
+    unsigned long last_flushes = 0;
+    unsigned long last_full_fetches = 0;
+    bool in_setup = true;
+    uint64_t loop_start_us = 0;
+    DisplayError display_error;
+    uint64_t next_truth_ms = 0;
+    uint64_t last_flush_ms = 0;
+    uint64_t longest_display_gap_ms = 0;
+    unsigned long last_display_flushes = 0;
+    long worst_clock_error = 0;
+    unsigned long resets = 0;
+    unsigned long bad_resets = 0;
+    uint64_t next_reset_ms = reset_every_ms;
+    unsigned long refreshes = 0;
+    unsigned long late_refreshes = 0;
+    unsigned long longest_refresh_delay_ms = 0;
+    unsigned long longest_loop_ms = 0;
+    unsigned long display_ram_mismatches = 0;
+    uint32_t first_history_time = 0;
+    size_t heap_peak_first_half = 0;   // Heap the sketch held after a fetch cycle, in each half of the run
+    size_t heap_peak_second_half = 0;
+    unsigned long heap_blocks_last = 0;   // Time of the first history sample (0 until there is one)
+    sim_clock::time_point start = sim_clock::now();
+    sim_clock::time_point last_cycle_end = start;
+
+    try {
+        host_count_heap = true;   // Only the sketch's allocations count, not the runner's
+        setup();
+        host_count_heap = false;
+        in_setup = false;
+        while (true) {
+            loop_start_us = host_elapsed_us();
+
+            // What was on the screen until now is what loop() is about to change
+            if (full_fetches == 0) {
+                next_truth_ms = loop_start_us / 1000;   // Nothing to compare yet
+            }
+            while (full_fetches > 0 && next_truth_ms <= loop_start_us / 1000) {
+                compare_with_truth(display_error, next_truth_ms);
+                next_truth_ms += TRUTH_SAMPLE_MS;
+            }
+
+            if (reset_every_ms > 0 && loop_start_us / 1000 >= next_reset_ms && fetch_state == FETCH_IDLE) {
+                resets++;
+                if (!simulate_reset()) bad_resets++;
+                next_reset_ms += reset_every_ms;
+            }
+
+            // When the timer runs out. loop() restarts it when it sees that (or when a
+            // fetch starts).
+            unsigned long refresh_due = previousMillis + interval;
+            unsigned long timer_start = previousMillis;
+
+            unsigned long loop_start_ms = millis();   // Light sleep doesn't count
+            host_count_heap = true;
+            loop();
+            host_count_heap = false;
+            loops++;
+            longest_loop_ms = max(longest_loop_ms, millis() - loop_start_ms);
+
+            if (previousMillis != timer_start && (long)(previousMillis - refresh_due) >= 0) {
+                unsigned long delay_ms = previousMillis - refresh_due;
+                refreshes++;
+                if (delay_ms > MAX_REFRESH_DELAY_MS) late_refreshes++;
+                longest_refresh_delay_ms = max(longest_refresh_delay_ms, delay_ms);
+            }
+
+            // How long did the screen go without an update?
+            if (display_flushes != last_display_flushes) {
+                if (memcmp(host_display_ram, display.getBuffer(), sizeof(host_display_ram)) != 0) {
+                    display_ram_mismatches++;
+                }
+                longest_display_gap_ms = max(longest_display_gap_ms, loop_start_us / 1000 - last_flush_ms);
+                last_flush_ms = loop_start_us / 1000;
+                last_display_flushes = display_flushes;
+            }
+            if (clock_is_set) {
+                long clock_error = (long)clock_now() - (long)host_unix_time();
+                worst_clock_error = max(worst_clock_error, labs(clock_error));
+            }
+
+            if (first_history_time == 0 && rtc_data.history.count > 0) {
+                first_history_time = rtc_data.history.last_time;
+            }
+
+            host_advance_us(LOOP_COST_US);
+
+            if (fetch_cycles != last_cycles) {   // A fetch cycle just finished
+                size_t& heap_peak = host_elapsed_us() < days * 43200000000.0 ? heap_peak_first_half
+                                                                             : heap_peak_second_half;
+                heap_peak = max(heap_peak, host_heap_used);
+                heap_blocks_last = host_heap_blocks;
+                sim_clock::time_point now = sim_clock::now();
+                cycles.push_back({ host_elapsed_us() / 1000,
+                                   std::chrono::duration<double, std::milli>(now - last_cycle_end).count(),
+                                   cycle_time_ms, radio_on_ms, display_flushes - last_flushes,
+                                   full_fetches != last_full_fetches ? bytes_parsed : 0 });
+                last_cycle_end = now;
+                last_cycles = fetch_cycles;
+                last_flushes = display_flushes;
+                last_full_fetches = full_fetches;
+            }
+        }
+    } catch (const HostTimeUp&) {
+        // The simulated time is up
+        host_count_heap = false;
+    }
+    double wall_ms = std::chrono::duration<double, std::milli>(sim_clock::now() - start).count();
+
+    // Add up the week
+    double simulated_hours = host_elapsed_us() / 3600000000.0;
+    unsigned long long total_bytes = 0;
+    unsigned long max_radio_ms = 0;
+    double max_wall_ms = 0;
+    for (const SimCycle& cycle : cycles) {
+        total_bytes += cycle.bytes_parsed;
+        max_radio_ms = max(max_radio_ms, cycle.radio_on_ms);
+        max_wall_ms = max(max_wall_ms, cycle.wall_ms);
+    }
+    size_t cycle_count = max(cycles.size(), (size_t)1);
+    bool halted = in_setup || host_elapsed_us() - loop_start_us >= HALTED_AFTER_MS * 1000ULL;
+
+    printf("Simulated %.1f hours (%.1f of them in light sleep) in %.0f ms: %lu runs of loop()\n",
+           simulated_hours, host_slept_us() / 3600000000.0, wall_ms, loops);
+    printf("Fetch cycles: %zu (%lu full, %lu not modified, %lu skipped, %lu from the forecast), %lu failed fetches\n",
+           cycles.size(), full_fetches, not_modified_fetches, skipped_fetches, forecast_updates, total_failures);
+    printf("Wall time: %.3f ms per fetch cycle (longest %.3f ms), %.2f us per loop()\n",
+           wall_ms / cycle_count, max_wall_ms, wall_ms * 1000 / max(loops, 1UL));
+    printf("Display: %lu flushes (%.1f per cycle), %llu I2C bytes, %lu times not showing the screen buffer\n",
+           display_flushes, (double)display_flushes / cycle_count, Wire.bytes_sent, display_ram_mismatches);
+    printf("Parsed: %llu bytes (%.0f per full fetch), JSON memory used %u of %u bytes\n",
+           total_bytes, full_fetches ? (double)total_bytes / full_fetches : 0.0,
+           (unsigned int)json_memory_used, (unsigned int)JSON_DOCUMENT_SIZE);
+    printf("Radio on: %lu ms (%.0f ms per cycle, longest %lu ms), %.3f%% of the time\n",
+           total_radio_on_ms, (double)total_radio_on_ms / cycle_count, max_radio_ms,
+           total_radio_on_ms / (simulated_hours * 36000.0));
+    printf("Server: %lu requests, %lu TLS handshakes, %lu resumed sessions, clock drift measured %ld ppm\n",
+           sim_server_stats.requests, sim_server_stats.tls_handshakes, sim_server_stats.tls_resumed, clock_drift_ppm);
+    unsigned long error_samples = max(display_error.samples, 1UL);
+    printf("Display vs true weather: temperature off by %.2f C on average (at most %.2f), pressure by %.2f hPa"
+           " (at most %.2f), with %lu requests (%.1f per day)\n",
+           display_error.temp_sum / error_samples, display_error.temp_max,
+           display_error.pressure_sum / error_samples, display_error.pressure_max,
+           sim_server_stats.requests, sim_server_stats.requests / (simulated_hours / 24));
+
+    printf("Checks: display updated at least every %.1f minutes, %ld s worst clock error, %lu resets"
+           " (%lu lost data)\n", longest_display_gap_ms / 60000.0, worst_clock_error, resets, bad_resets);
+    printf("Longest loop(): %lu ms (the sketch measured %lu ms in the last cycle)\n",
+           longest_loop_ms, max_loop_ms);
+    const WeatherHistory& history = rtc_data.history;
+    const uint32_t history_step = HISTORY_INTERVAL * 60UL;
+    unsigned long history_expected = history.count == 0 ? 0
+        : min((history.last_time - first_history_time) / history_step + 1, (uint32_t)HISTORY_LENGTH);
+    long history_age = (long)host_unix_time() - (long)history.last_time;
+    printf("History: %u samples (%lu expected), the newest %ld minutes old\n",
+           history.count, history_expected, history_age / 60);
+    printf("Heap: %zu bytes in %lu blocks after the last fetch cycle, at most %zu after a cycle in the first"
+           " half and %zu in the second half, peak %zu, lowest free heap %u\n",
+           host_heap_used, heap_blocks_last, heap_peak_first_half, heap_peak_second_half, host_heap_peak,
+           (unsigned int)lowest_free_heap);
+    printf("Light sleep: %lu timer and %lu button wakes (the board counted %lu and %lu), %lu refreshes"
+           " (%lu late, at most %lu ms)\n", timer_wakes, button_wakes, host_timer_wakes, host_button_wakes,
+           refreshes, late_refreshes, longest_refresh_delay_ms);
+
+    if (csv_name) {
+        FILE* csv = fopen(csv_name, "w");
+        if (csv == nullptr) {
+            perror(csv_name);
+            return 2;
+        }
+        fprintf(csv, "end_ms,wall_ms,cycle_ms,radio_on_ms,flushes,bytes_parsed\n");
+        for (const SimCycle& cycle : cycles) {
+            fprintf(csv, "%llu,%.3f,%lu,%lu,%lu,%zu\n", (unsigned long long)cycle.end_ms, cycle.wall_ms,
+                    cycle.cycle_ms, cycle.radio_on_ms, cycle.flushes, cycle.bytes_parsed);
+        }
+        fclose(csv);
+    }
+
+    if (halted) {
+        printf("The sketch stopped %s\n", in_setup ? "in setup()" : "(loop() didn't return)");
+        return 1;
+    }
+    if (cycles.empty()) {
+        printf("No fetch cycle finished\n");
+        return 1;
+    }
+    if (expect_failures && total_failures == 0) {
+        printf("No fetch failed, but the outages should have made some fail\n");
+        return 1;
+    }
+
+    // The display and fetch timing, the clock and the RTC memory
+    int problems = 0;
+    if (longest_display_gap_ms > LONGEST_DISPLAY_GAP_MS) {
+        printf("The display went %.1f minutes without an update (at most %.1f expected)\n",
+               longest_display_gap_ms / 60000.0, LONGEST_DISPLAY_GAP_MS / 60000.0);
+        problems++;
+    }
+    double outage_minutes = 0;
+    for (const HostOutage& outage : host_wifi.outages) outage_minutes += outage.length_ms / 60000.0;
+    for (const HostOutage& outage : sim_server.outages) outage_minutes += outage.length_ms / 60000.0;
+    double simulated_minutes = simulated_hours * 60;
+    unsigned long good_fetches = full_fetches + not_modified_fetches;
+    unsigned long most_fetches = simulated_minutes / MIN_FETCH_INTERVAL + 1 + resets;
+    unsigned long fewest_fetches = max(simulated_minutes - outage_minutes, 0.0) / MAX_FETCH_INTERVAL;
+    if (good_fetches > most_fetches || good_fetches < fewest_fetches) {
+        printf("%lu fetches got data, expected %lu to %lu\n", good_fetches, fewest_fetches, most_fetches);
+        problems++;
+    }
+    if (worst_clock_error > MAX_CLOCK_ERROR) {
+        printf("The clock was off by %ld s (at most %d expected)\n", worst_clock_error, MAX_CLOCK_ERROR);
+        problems++;
+    }
+    if (longest_loop_ms > LONGEST_LOOP_MS) {
+        printf("A run of loop() took %lu ms (at most %d ms expected)\n", longest_loop_ms, LONGEST_LOOP_MS);
+        problems++;
+    }
+    if (late_refreshes > 0) {
+        printf("%lu refreshes came more than %d ms late (light sleep slept through them)\n",
+               late_refreshes, MAX_REFRESH_DELAY_MS);
+        problems++;
+    }
+    if (timer_wakes != host_timer_wakes || button_wakes != host_button_wakes) {
+        printf("The sketch counted different wakes than the board\n");
+        problems++;
+    }
+    if (host_button_period_ms > 0 && host_button_wakes == 0) {
+        printf("The button was pressed, but never woke the board\n");
+        problems++;
+    }
+    if (heap_peak_second_half > heap_peak_first_half + HEAP_GROWTH_ALLOWED) {
+        printf("The heap held after a fetch cycle grew from %zu to %zu bytes (a leak?)\n",
+               heap_peak_first_half, heap_peak_second_half);
+        problems++;
+    }
+    if (display_ram_mismatches > 0) {
+        printf("The display memory didn't match the screen buffer after %lu flushes\n", display_ram_mismatches);
+        problems++;
+    }
+    if (history.count != history_expected
+        || history_age > (long)(history_step + LONGEST_DISPLAY_GAP_MS / 1000 + MAX_CLOCK_ERROR)) {
+        printf("The history is missing samples or has too many\n");
+        problems++;
+    }
+    if (bad_resets > 0) {
+        printf("%lu of %lu resets didn't get everything back from RTC memory\n", bad_resets, resets);
+        problems++;
+    }
+    return problems > 0 ? 1 : 0;
+}
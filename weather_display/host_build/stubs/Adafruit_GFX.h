@@ -0,0 +1,43 @@
+// Host (Linux) stand-in for Adafruit_GFX: text and the few shapes the sketch draws.
+// The characters are not the real font, each one just gets its own pattern of
+// pixels (the host build never looks at the screen, it only compares and counts it).
+#pragma once
+
+#include <Arduino.h>
+
+struct GFXfont;
+
+class Adafruit_GFX : public Print {
+    public:
+        Adafruit_GFX(int16_t w, int16_t h) : WIDTH(w), HEIGHT(h), _width(w), _height(h) {}
+
+        virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+        void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color);
+        void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+        void drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg, uint8_t size);
+        size_t write(uint8_t c) override;
+        using Print::write;
+
+        void setCursor(int16_t x, int16_t y) { cursor_x = x; cursor_y = y; }
+        void setTextSize(uint8_t size) { textsize_x = textsize_y = size > 0 ? size : 1; }
+        void setTextColor(uint16_t color) { textcolor = textbgcolor = color; }
+        void setTextWrap(bool wrap) { this->wrap = wrap; }
+        uint8_t getRotation() const { return rotation; }
+        int16_t width() const { return _width; }
+        int16_t height() const { return _height; }
+
+    protected:
+        const int16_t WIDTH;
+        const int16_t HEIGHT;
+        int16_t _width;
+        int16_t _height;
+        int16_t cursor_x = 0;
+        int16_t cursor_y = 0;
+        uint16_t textcolor = 0xFFFF;
+        uint16_t textbgcolor = 0xFFFF;
+        uint8_t textsize_x = 1;
+        uint8_t textsize_y = 1;
+        uint8_t rotation = 0;
+        bool wrap = true;
+        GFXfont* gfxFont = nullptr;
+};
@@ -0,0 +1,143 @@
+//------------------------------------------------------------------------------------
+// Host (Linux) stand-in for the ESP8266 Arduino core
+//
+// Only the parts the weather display sketch uses are here. Time doesn't come from
+// a real clock: millis(), micros() and delay() use the virtual clock in host_hal.cpp,
+// so a whole week of loop() can run in well under a second.
+//------------------------------------------------------------------------------------
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+
+using std::min;
+using std::max;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Only needed on the board (it switches the ADC over to measuring the supply voltage)
+#define ADC_VCC 1
+#define ADC_MODE(mode)
+
+typedef uint8_t byte;
+
+// Time (virtual, see host_hal.h)
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+// Pins (only the Flash button is simulated)
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+
+// Random numbers (the same every run, unless the seed is changed)
+long random(long max_value);
+long random(long min_value, long max_value);
+void randomSeed(unsigned long seed);
+
+// The ESP8266 C library has strlcpy(), glibc (before 2.38) doesn't
+size_t host_strlcpy(char* destination, const char* source, size_t size);
+#define strlcpy host_strlcpy
+
+
+// Arduino's String, just enough for HTTP header values
+class String {
+    public:
+        String() {}
+        String(const char* text) : text(text ? text : "") {}
+        String(const std::string& text) : text(text) {}
+
+        const char* c_str() const { return text.c_str(); }
+        unsigned int length() const { return text.length(); }
+        bool equalsIgnoreCase(const String& other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+        bool operator==(const String& other) const { return text == other.text; }
+        bool operator==(const char* other) const { return text == other; }
+        String& operator+=(const String& other) { text += other.text; return *this; }
+        String& operator+=(char c) { text += c; return *this; }
+
+    private:
+        std::string text;
+};
+
+
+// Everything that can be printed to (Serial, the display)
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size);
+        size_t write(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+
+        size_t print(const char* text) { return write(text); }
+        size_t print(const String& text) { return write(text.c_str()); }
+        size_t print(char c) { return write((uint8_t)c); }
+        size_t print(int value) { return print((long)value); }
+        size_t print(unsigned int value) { return print((unsigned long)value); }
+        size_t print(long value);
+        size_t print(unsigned long value);
+        size_t print(double value, int digits = 2);
+
+        size_t println() { return write("\r\n"); }
+        template <typename T> size_t println(const T& value) { size_t n = print(value); return n + println(); }
+
+        size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+
+// A source of bytes (network clients, the reply body)
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        // Read up to length bytes, waiting at most the timeout for each one
+        virtual size_t readBytes(char* buffer, size_t length);
+        void setTimeout(unsigned long timeout) { stream_timeout = timeout; }
+
+    protected:
+        unsigned long stream_timeout = 1000;
+};
+
+
+// Serial output goes to stdout (only if host_serial_echo is set, see host_hal.h)
+class HardwareSerial : public Stream {
+    public:
+        void begin(unsigned long baud) { (void)baud; }
+        void flush() {}
+        int available() override { return 0; }
+        int read() override { return -1; }
+        int peek() override { return -1; }
+        size_t write(uint8_t c) override;
+        using Print::write;
+};
+extern HardwareSerial Serial;
+
+
+// The ESP object (heap, supply voltage, RTC memory, hardware random numbers)
+class EspClass {
+    public:
+        uint32_t getFreeHeap();
+        uint32_t getMaxFreeBlockSize();
+        uint8_t getHeapFragmentation();
+        uint16_t getVcc();
+        uint32_t random();
+        bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+        bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+};
+extern EspClass ESP;
@@ -0,0 +1,57 @@
+// Host (Linux) stand-in for the ESP8266HTTPClient library. It speaks real HTTP over
+// a WiFiClient, so it works the same with the simulated server and a real one.
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <vector>
+
+#define HTTPC_ERROR_CONNECTION_FAILED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+typedef enum {
+    HTTP_CODE_OK = 200,
+    HTTP_CODE_NOT_MODIFIED = 304,
+    HTTP_CODE_TOO_MANY_REQUESTS = 429,
+    HTTP_CODE_INTERNAL_SERVER_ERROR = 500,
+    HTTP_CODE_SERVICE_UNAVAILABLE = 503
+} t_http_codes;
+
+class HTTPClient {
+    public:
+        bool begin(WiFiClient& client, const char* host, uint16_t port, const char* uri = "/", bool https = false);
+        void end();
+
+        void useHTTP10(bool use_http10) { http10 = use_http10; }
+        void setTimeout(uint16_t timeout) { this->timeout = timeout; }
+        void addHeader(const String& name, const String& value);
+        void collectHeaders(const char* header_keys[], const size_t count);
+
+        int GET();
+
+        String header(const char* name);
+        bool hasHeader(const char* name);
+        WiFiClient& getStream() { return *client; }
+
+    private:
+        struct Header {
+            std::string name;
+            std::string value;
+            bool found;
+        };
+
+        WiFiClient* client = nullptr;
+        std::string host;
+        uint16_t port = 80;
+        std::string uri;
+        bool http10 = false;
+        uint16_t timeout = 5000;
+        std::string request_headers;
+        std::vector<Header> collected;
+
+        bool read_line(std::string& line);
+};
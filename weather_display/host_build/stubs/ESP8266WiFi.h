@@ -0,0 +1,89 @@
+// Host (Linux) stand-in for the ESP8266WiFi library.
+// Connecting to the access point is simulated (see host_hal.h). Network
+// connections go to whatever host_open_connection points at: the simulated
+// weather server, or a real socket.
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+typedef enum {
+    WL_NO_SHIELD = 255,
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_WRONG_PASSWORD = 6,
+    WL_DISCONNECTED = 7
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} WiFiMode_t;
+
+
+// One open network connection (made by host_open_connection, see host_hal.h)
+class HostConnection {
+    public:
+        virtual ~HostConnection() {}
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+        virtual bool connected() = 0;   // True while the other side is open (or data is waiting)
+};
+
+
+class WiFiClient : public Stream {
+    public:
+        WiFiClient() {}
+        virtual ~WiFiClient() { stop(); }
+
+        virtual int connect(const char* host, uint16_t port);
+        virtual uint8_t connected();
+        virtual void stop();
+
+        int available() override;
+        int read() override;
+        int peek() override;
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t* buffer, size_t size) override;
+        using Print::write;
+
+    protected:
+        HostConnection* connection = nullptr;
+
+    private:
+        WiFiClient(const WiFiClient&) = delete;
+        WiFiClient& operator=(const WiFiClient&) = delete;
+};
+
+
+class ESP8266WiFiClass {
+    public:
+        bool mode(WiFiMode_t mode);
+        bool persistent(bool persistent) { (void)persistent; return true; }
+        wl_status_t begin(const char* ssid, const char* password, int32_t channel = 0,
+                          const uint8_t* bssid = nullptr, bool connect = true);
+        bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress());
+        bool disconnect(bool wifi_off = false);
+        wl_status_t status();
+
+        int32_t channel();
+        uint8_t* BSSID();
+        IPAddress localIP();
+        IPAddress gatewayIP();
+        IPAddress subnetMask();
+        IPAddress dnsIP(uint8_t number = 0);
+
+        bool forceSleepBegin(uint32_t sleep_us = 0);
+        bool forceSleepWake();
+};
+extern ESP8266WiFiClass WiFi;
+
+#include <WiFiClientSecure.h>
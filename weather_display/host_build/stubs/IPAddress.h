@@ -0,0 +1,16 @@
+// Host (Linux) stand-in for the ESP8266 core's IPAddress (an IPv4 address)
+#pragma once
+
+#include <stdint.h>
+
+class IPAddress {
+    public:
+        IPAddress() : address(0) {}
+        IPAddress(uint32_t address) : address(address) {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+            : address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}   // First byte lowest, like lwIP
+        operator uint32_t() const { return address; }
+
+    private:
+        uint32_t address;
+};
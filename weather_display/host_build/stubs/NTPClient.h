@@ -0,0 +1,20 @@
+// Host (Linux) stand-in for the NTPClient library. The time comes from the virtual
+// clock (see host_hal.h), and a sync takes as long as host_ntp_ms.
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+class NTPClient {
+    public:
+        NTPClient(WiFiUDP& udp, const char* pool_name, long offset_seconds)
+            : offset_seconds(offset_seconds) { (void)udp; (void)pool_name; }
+
+        void begin() {}
+        bool update();                     // False if the Wi-Fi is not connected
+        unsigned long getEpochTime();      // Local time (unix time plus the offset)
+
+    private:
+        long offset_seconds;
+        bool synced = false;
+};
@@ -0,0 +1,2 @@
+// Host (Linux) stand-in: the display is on I2C, so nothing from SPI is used
+#pragma once
@@ -0,0 +1,40 @@
+// Host (Linux) stand-in for the BearSSL WiFiClientSecure of the ESP8266 core
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+namespace BearSSL {
+
+// A TLS session that can be resumed. Laid out like BearSSL's br_ssl_session_parameters
+// (86 bytes), so RtcData has the same size as on the board.
+class Session {
+    public:
+        Session() : session_id(), session_id_len(0), version(0), cipher_suite(0), master_secret() {}
+
+        uint8_t session_id[32];
+        uint8_t session_id_len;
+        uint16_t version;
+        uint16_t cipher_suite;
+        uint8_t master_secret[48];
+};
+
+
+class WiFiClientSecure : public WiFiClient {
+    public:
+        int connect(const char* host, uint16_t port) override;
+
+        void setInsecure() { insecure = true; }
+        bool setFingerprint(const char* fingerprint);   // "AB CD EF ..." or "AB:CD:EF:..."
+        void setSession(Session* session) { this->session = session; }
+
+        // Host only: what the last connect() did, for the simulation and the tests
+        bool insecure = false;
+        bool have_fingerprint = false;
+        uint8_t fingerprint[20];
+        Session* session = nullptr;
+        bool session_resumed = false;
+};
+
+}   // namespace BearSSL
+
+using BearSSL::WiFiClientSecure;
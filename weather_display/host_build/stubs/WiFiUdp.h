@@ -0,0 +1,4 @@
+// Host (Linux) stand-in for WiFiUDP (only passed to NTPClient, which doesn't use it here)
+#pragma once
+
+class WiFiUDP {};
@@ -0,0 +1,35 @@
+// Host (Linux) stand-in for the I2C library. The bytes are counted, the virtual clock
+// moves on by the time they would take on the bus, and what is sent to the display
+// goes to an emulated display (see host_hal.h).
+#pragma once
+
+#include <Arduino.h>
+
+#define BUFFER_LENGTH 128   // Like the ESP8266 library: bytes past this are dropped
+
+class TwoWire {
+    public:
+        void begin(int sda, int scl) { (void)sda; (void)scl; }
+        void setClock(uint32_t clock) { this->clock = clock; }
+        void beginTransmission(uint8_t address) { this->address = address; pending = 0; }
+        size_t write(uint8_t data) {
+            if (pending >= BUFFER_LENGTH) return 0;
+            buffer[pending++] = data;
+            return 1;
+        }
+        size_t write(const uint8_t* data, size_t size) {
+            size_t written = 0;
+            while (written < size && write(data[written])) written++;
+            return written;
+        }
+        uint8_t endTransmission(bool send_stop = true);
+
+        uint32_t clock = 100000;
+        unsigned long long bytes_sent = 0;   // Host only: every byte (and address) sent since boot
+
+    private:
+        uint8_t address = 0;
+        uint8_t buffer[BUFFER_LENGTH];
+        size_t pending = 0;
+};
+extern TwoWire Wire;
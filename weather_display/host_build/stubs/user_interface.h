@@ -0,0 +1,27 @@
+// Host (Linux) stand-in for the ESP8266 SDK's user_interface.h (only light sleep and
+// the RTC timer). Light sleep is simulated: the virtual clock jumps ahead to the
+// wakeup time (or the next button press), without millis() seeing it.
+#pragma once
+
+#include <stdint.h>
+
+#define NULL_MODE 0x00
+#define STATION_MODE 0x01
+
+enum sleep_type {
+    NONE_SLEEP_T = 0,
+    LIGHT_SLEEP_T,
+    MODEM_SLEEP_T
+};
+typedef void (*fpm_wakeup_cb)(void);
+
+uint32_t system_get_rtc_time(void);
+uint32_t system_rtc_clock_cali_proc(void);
+
+bool wifi_set_opmode_current(uint8_t opmode);
+void wifi_fpm_open(void);
+void wifi_fpm_close(void);
+void wifi_fpm_do_wakeup(void);
+int8_t wifi_fpm_do_sleep(uint32_t sleep_time_us);
+void wifi_fpm_set_sleep_type(enum sleep_type type);
+void wifi_fpm_set_wakeup_cb(fpm_wakeup_cb callback);
@@ -0,0 +1,2329 @@
+//------------------------------------------------------------------------------------
+// Weather Display (v1.6)
+// for HW-364a and HW-364b development boards
+// Jeffrey D. Shaffer
+// 2025-08-18
+//
+//------------------------------------------------------------------------------------
+// This program fetches the current weather conditions and displays it on the
+// built-in OLED display, which is updated at least every 30 minutes. How often new
+// data is fetched depends on the forecast and on the weather (see below). To save
+// energy, it puts the WiFi to sleep between data fetches.
+//
+// After a network connection problem, it displays a notification, waits a while,
+// then tries to reconnect.
+//
+// The last Wi-Fi access point and weather reading are kept in RTC memory, so
+// reconnecting is faster and the screen can be redrawn right away after a reset.
+// The TLS session is saved too, so the next HTTPS request can skip most of the
+// (slow) TLS handshake.
+//
+// Optionally, the forecast for the next few hours is fetched along with the
+// current weather. Between fetches the display is then moved along that
+// forecast without turning on the Wi-Fi, so fetches can be hours apart.
+//
+// Several locations can be shown. They are all fetched with one request, and the
+// "Flash" button steps through them.
+//
+// How often new data is fetched adapts to the weather: less often when it is
+// stable (or at night, or when the battery is low), more often when it changes fast.
+//
+// The last 48 hours of temperature and pressure are kept as well, and can be
+// shown as small graphs (press the "Flash" button a second time).
+//
+// Between fetches the CPU is put into light sleep. It wakes up when it is time
+// for the next fetch, or when the "Flash" button is pressed.
+//
+// The weather data is parsed straight from the network stream (no big String
+// copy), and only the fields we actually use are kept in memory. All of our own
+// text lives in fixed-size char buffers, so the heap doesn't get fragmented over
+// weeks of running.
+//
+//------------------------------------------------------------------------------------
+// Notes:
+//    - Defaults to Suruga-ku, Shizuoka, Japan
+//    - Many settings are configurable
+//    - Don't forget to use your SSID and Wi-Fi password
+//
+//------------------------------------------------------------------------------------
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
+#include <WiFiClientSecure.h>
+#include <ArduinoJson.h>
+
+// Required for the OLED display
+#include <SPI.h>
+#include <Wire.h>
+#include <Adafruit_GFX.h>
+#include <Adafruit_SSD1306.h>
+
+// Required for getting the time from the internet
+#include <NTPClient.h>
+#include <WiFiUdp.h>
+
+// Required for light sleep (ESP8266 SDK functions)
+extern "C" {
+#include <user_interface.h>
+#include <gpio.h>
+}
+
+// OLED Display Configuration
+#define SCREEN_WIDTH 128          // OLED display width, in pixels
+#define SCREEN_HEIGHT 64          // OLED display height, in pixels
+#define OLED_RESET -1             // Reset pin # (or -1 if sharing Arduino reset pin)
+#define SCREEN_ADDRESS 0x3C       // The I2C address of the display
+#define OLED_SDA 14               // Correct SDA pin for your wiring (D6 on most boards)
+#define OLED_SCL 12               // Correct SCL pin for your wiring (D5 on most boards)
+#define REFRESH_INTERVAL 30       // How often (in minutes) to refresh the data
+
+// Sleep Configuration
+#define USE_LIGHT_SLEEP true          // Light-sleep the CPU between fetches (false = stay awake)
+#define MAX_LIGHT_SLEEP_MS 250000     // Longest single light sleep (the SDK limit is ~268 seconds)
+
+// Energy Estimate Configuration (rough numbers, used for the Serial report only)
+#define RADIO_ON_CURRENT_MA 70.0      // Current draw while the Wi-Fi is awake, in mA
+#define RADIO_OFF_CURRENT_MA 15.0     // Current draw while the Wi-Fi is asleep, in mA
+#define LIGHT_SLEEP_CURRENT_MA 1.0    // Current draw while the CPU is in light sleep, in mA
+#define BATTERY_CAPACITY_MAH 800.0    // Two AAA batteries, in mAh
+
+#define OLED_CHUNK_SIZE 128       // Bytes per I2C transfer (the ESP8266 Wire buffer is 128 bytes)
+#define I2C_CLOCK 400000          // I2C bus speed: 100000 (standard), 400000 (fast), 800000 (experimental)
+#define USE_GLYPH_CACHE true      // Copy pre-drawn characters instead of drawing them pixel by pixel
+#define FIRST_CACHED_CHAR ' '     // The glyph cache holds the printable ASCII characters
+#define LAST_CACHED_CHAR '~'
+#define CACHED_CHAR_COUNT (LAST_CACHED_CHAR - FIRST_CACHED_CHAR + 1)
+#define USE_PREBUILT_LAYOUTS true // Draw the weather screens from the layouts below (false = old printf code)
+
+// An SSD1306 display that only sends the parts of the screen that changed.
+// The screen is made of 8 "pages" (rows of 8 pixels). For each page, only the
+// columns between the first and the last changed byte are sent over I2C.
+//
+// It also keeps a cache of every character already drawn at text sizes 1 and 2.
+// In the screen buffer each byte is one column of 8 pixels of a page, so when
+// the text lines up with a page, a character is just copied in byte by byte.
+class FastSSD1306 : public Adafruit_SSD1306 {
+    public:
+        FastSSD1306(uint8_t w, uint8_t h, TwoWire* twi, int8_t rst_pin, uint32_t clock)
+            : Adafruit_SSD1306(w, h, twi, rst_pin, clock, clock) {}
+
+        // Send only the changed parts of the screen buffer to the display
+        void displayChanges() {
+            uint8_t* frame = getBuffer();
+            unsigned long sent = 0;
+
+            wire->setClock(wireClk);
+            for (int page = 0; page < SCREEN_HEIGHT / 8; page++) {
+                uint8_t* row = frame + page * SCREEN_WIDTH;
+                uint8_t* old_row = last_frame + page * SCREEN_WIDTH;
+
+                // Find the first and last columns that changed (send everything the first time)
+                int first = 0;
+                int last = SCREEN_WIDTH - 1;
+                if (have_last_frame) {
+                    while (first < SCREEN_WIDTH && row[first] == old_row[first]) first++;
+                    if (first == SCREEN_WIDTH) continue;   // Nothing changed in this page
+                    while (row[last] == old_row[last]) last--;
+                }
+
+                // Tell the display which part of the screen we are about to send
+                const uint8_t window[] = {
+                    SSD1306_PAGEADDR, (uint8_t)page, (uint8_t)page,
+                    SSD1306_COLUMNADDR, (uint8_t)first, (uint8_t)last
+                };
+                ssd1306_commandList(window, sizeof(window));
+                sent += sizeof(window) + 1;
+
+                // Send the changed bytes (0x40 = "data follows")
+                for (int column = first; column <= last; column += OLED_CHUNK_SIZE - 1) {
+                    int count = min(last - column + 1, OLED_CHUNK_SIZE - 1);
+                    wire->beginTransmission(i2caddr);
+                    wire->write((uint8_t)0x40);
+                    wire->write(row + column, count);
+                    wire->endTransmission();
+                    sent += count + 1;
+                }
+
+                memcpy(old_row + first, row + first, last - first + 1);
+            }
+            wire->setClock(restoreClk);
+
+            have_last_frame = true;
+            bytes_sent_last = sent;
+            bytes_sent_total += sent;
+        }
+
+        // Draw every cached character once with Adafruit_GFX and keep the bytes
+        void buildGlyphCache() {
+            uint8_t* frame = getBuffer();
+            for (int i = 0; i < CACHED_CHAR_COUNT; i++) {
+                clearDisplay();
+                drawChar(0, 0, FIRST_CACHED_CHAR + i, SSD1306_WHITE, SSD1306_WHITE, 1);
+                memcpy(small_glyphs[i], frame, 6);
+
+                clearDisplay();
+                drawChar(0, 0, FIRST_CACHED_CHAR + i, SSD1306_WHITE, SSD1306_WHITE, 2);
+                memcpy(large_glyphs[i][0], frame, 12);                  // Top page
+                memcpy(large_glyphs[i][1], frame + SCREEN_WIDTH, 12);   // Bottom page
+            }
+            clearDisplay();
+            have_glyph_cache = true;
+        }
+
+        // Called by print()/printf() for every character
+        size_t write(uint8_t c) override {
+            if (!USE_GLYPH_CACHE || !have_glyph_cache || c < FIRST_CACHED_CHAR || c > LAST_CACHED_CHAR ||
+                gfxFont || getRotation() != 0 || textcolor != SSD1306_WHITE || textbgcolor != textcolor ||
+                textsize_x != textsize_y || (textsize_x != 1 && textsize_x != 2)) {
+                return Adafruit_SSD1306::write(c);   // Not something the cache can draw
+            }
+
+            // Move to the next line if the character doesn't fit (just like Adafruit_GFX)
+            int columns = 6 * textsize_x;
+            if (wrap && (cursor_x + columns) > SCREEN_WIDTH) {
+                cursor_x = 0;
+                cursor_y += 8 * textsize_y;
+            }
+            if (cursor_x < 0 || cursor_y < 0 || (cursor_y % 8) != 0 || cursor_y + 8 * textsize_y > SCREEN_HEIGHT) {
+                return Adafruit_SSD1306::write(c);   // Not lined up with a page
+            }
+
+            uint8_t* frame = getBuffer();
+            int page = cursor_y / 8;
+            int glyph = c - FIRST_CACHED_CHAR;
+            for (int column = 0; column < columns && cursor_x + column < SCREEN_WIDTH; column++) {
+                int x = cursor_x + column;
+                if (textsize_x == 1) {
+                    frame[page * SCREEN_WIDTH + x] |= small_glyphs[glyph][column];
+                } else {
+                    frame[page * SCREEN_WIDTH + x] |= large_glyphs[glyph][0][column];
+                    frame[(page + 1) * SCREEN_WIDTH + x] |= large_glyphs[glyph][1][column];
+                }
+            }
+            cursor_x += columns;
+            return 1;
+        }
+
+        unsigned long bytes_sent_last = 0;    // I2C bytes sent for the last update
+        unsigned long bytes_sent_total = 0;   // I2C bytes sent since boot
+
+    private:
+        uint8_t last_frame[SCREEN_WIDTH * SCREEN_HEIGHT / 8];   // What the display is showing now
+        bool have_last_frame = false;
+
+        uint8_t small_glyphs[CACHED_CHAR_COUNT][6];        // Text size 1: 6 columns, 1 page
+        uint8_t large_glyphs[CACHED_CHAR_COUNT][2][12];    // Text size 2: 12 columns, 2 pages
+        bool have_glyph_cache = false;
+};
+
+FastSSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET, I2C_CLOCK);
+
+// Button-press Configuration
+const int buttonPin = 0;          // Use the "Flash" butoon (GPIO0)
+unsigned long lastPressTime = 0;  // Used for timing the debounce delay
+const int debounceDelay = 200;    // Debounce delay duration in milliseconds
+int user_selected_text_size = 1;  // Start at text size 1 (default)
+bool showing_history = false;     // True when the history graphs are on the screen
+bool showing_status = false;      // True when a status message (not the weather) is on the screen
+
+// Wi-Fi Configuration
+const char* ssid = "YOUR SSID GOES HERE";
+const char* password = "YOUR WIFI PASSWORD GOES HERE";
+int maxAttempts = 3;             // Max number of wi-fi connection attempts to try
+#define CONNECT_TIMEOUT 10000     // How long (in ms) to wait for each connection attempt
+#define FAST_CONNECT_TIMEOUT 5000 // How long (in ms) to try the saved access point before scanning
+#define HTTP_TIMEOUT 5000         // How long (in ms) to wait for the weather server to answer
+#define BODY_TIMEOUT 10000        // Longest time (in ms) to spend reading the reply
+#define IDLE_TIMEOUT 3000         // Give up if no data arrives for this long (in ms)
+#define MAX_BODY_SIZE 16384       // Never read more than this many bytes of reply
+
+// Retry Configuration
+// After a failure we wait before trying again, twice as long after every failure in a row
+// (up to a limit), so a long outage doesn't drain the battery. A little randomness (jitter)
+// stops several displays from all retrying at the same moment.
+#define RETRY_JITTER 20           // Randomly change each wait by up to this many percent
+enum FailureKind {
+    FAILURE_NONE,
+    FAILURE_WIFI_LOST,        // WL_DISCONNECTED, WL_CONNECT_FAILED, WL_CONNECTION_LOST (or unknown)
+    FAILURE_WIFI_NOT_FOUND,   // WL_NO_SSID_AVAIL (maybe the access point is just switched off)
+    FAILURE_CONNECTION,       // Couldn't reach the weather server (DNS, TLS or timeout)
+    FAILURE_SERVER,           // The server is busy or broken (HTTP 5xx, or 429 Too Many Requests)
+    FAILURE_REQUEST,          // The server didn't like our request (any other HTTP code)
+    FAILURE_DATA              // The response couldn't be read as JSON
+};
+struct RetryPolicy {
+    const char* name;         // For the Serial report
+    const char* message;      // Shown above the countdown
+    uint16_t first_delay;     // Minutes to wait after the first failure
+    uint16_t max_delay;       // Longest wait, in minutes
+};
+const RetryPolicy retry_policies[] = {
+    { "ok",                "",                                         0,   0 },   // FAILURE_NONE
+    { "wifi lost",         "    Disconnected\n    from network",        5,  60 },
+    { "wifi not found",    "  Network not found\n  Check SSID name",   10, 120 },
+    { "connection error",  "  Connection error!",                       1,  30 },
+    { "server error",      "    Server error!",                         5,  60 },
+    { "http error",        "     HTTP Error!",                         60, 360 },
+    { "json error",        "     JSON Error!",                          5,  60 },
+};
+#define REUSE_IP_ADDRESS false    // Reuse the last IP address instead of asking DHCP again
+
+// Weather API Configuration
+const char* server_host = "api.open-meteo.com";
+#define SERVER_PORT 443           // 443 for HTTPS, 80 for plain HTTP
+#define USE_HTTPS true            // Set to false (with port 80) to test against a plain HTTP server,
+                                  // e.g. one on your own computer that replays saved responses
+// Optional: SHA-1 fingerprint of the server's certificate (e.g. "AB CD EF ...").
+// If left empty, all certificates are accepted. Note that the fingerprint
+// changes whenever the server gets a new certificate.
+const char* server_fingerprint = "";
+// The locations to show. They are all fetched with a single request. The first one is
+// "home": it drives the adaptive refresh and has the history graphs. Add more lines to
+// show more locations (the name should fit in 19 letters). The last reading of every
+// location is kept in RTC memory, which has room for about 5 locations.
+struct Location {
+    const char* name;
+    const char* latitude;
+    const char* longitude;
+};
+const Location locations[] = {
+    { "Suruga-ku", "34.9717465", "138.378599" },
+};
+#define LOCATION_COUNT (int)(sizeof(locations) / sizeof(locations[0]))
+const char* timezone_name = "Asia%2FTokyo";   // The "/" is written as "%2F"
+const char* weather_model = "jma_seamless";
+#define COMPACT_TIME_FORMAT true  // Ask for times as unix timestamps (shorter than ISO dates)
+#define USE_CONDITIONAL_FETCH true // Don't fetch data that can't have changed yet (see below)
+#define SERVER_UPDATE_MARGIN 60   // Fetch this many seconds after the server's data is updated
+
+// Forecast Configuration
+#define USE_FORECAST true              // Also fetch an hourly forecast and update the display from it
+#define FORECAST_HOURS 6               // Number of hourly forecast values to fetch
+#define FORECAST_REFRESH_INTERVAL 180  // Longest time (in minutes) to go without fetching new data
+
+// Adaptive Refresh Configuration
+#define USE_ADAPTIVE_REFRESH true      // Change how often we fetch depending on the weather and battery
+#define MIN_FETCH_INTERVAL 15          // Shortest time (in minutes) between fetches
+#define MAX_FETCH_INTERVAL 360         // Longest time (in minutes) between fetches
+#define FAST_TEMP_CHANGE 15            // A temperature change of 1.5 C per hour or more is "fast"
+#define FAST_PRESSURE_CHANGE 10        // A pressure change of 1.0 hPa per hour or more is "fast"
+#define STABLE_TEMP_CHANGE 5           // 0.5 C per hour or less is "stable"
+#define STABLE_PRESSURE_CHANGE 3       // 0.3 hPa per hour or less is "stable"
+#define DEFAULT_FETCH_INTERVAL (USE_FORECAST ? FORECAST_REFRESH_INTERVAL : REFRESH_INTERVAL)  // Until we know how fast it changes
+#define NIGHT_START_HOUR 22            // Fetch less often between these hours
+#define NIGHT_END_HOUR 6
+#define LOW_BATTERY_MV 2700            // Below this supply voltage, fetch as rarely as possible
+#define WEAK_BATTERY_MV 2900           // Below this supply voltage, fetch half as often
+
+// Let ESP.getVcc() measure the supply voltage (the battery) with the ADC
+ADC_MODE(ADC_VCC);
+char server_path[512];            // Built at boot by build_server_path()
+
+// One weather reading. Every value is stored as a whole number of tenths
+// (23.5 C is stored as 235), so storing and displaying it needs no floating-point
+// math (the ESP8266 has no FPU). Unit conversions are done once, when parsing.
+struct WeatherSample {
+    int16_t temp_c;              // Temperature, in 0.1 C
+    int16_t feels_like_c;        // Apparent temperature, in 0.1 C
+    int16_t humidity_percent;    // Relative humidity, in 0.1 %
+    int16_t pressure_hpa;        // Surface pressure, in 0.1 hPa
+    int16_t wind_speed_mps;      // Wind speed, in 0.1 m/s (the API sends km/h)
+    int16_t wind_direction_deg;  // Wind direction, in 0.1 degrees
+    int16_t cloud_cover_percent; // Cloud cover, in 0.1 %
+    int16_t precipitation_mm;    // Precipitation, in 0.1 mm
+};
+
+// Variables for Storing WX Data
+// Global on purpose, so display_weather() can access it every time the button is pressed
+WeatherSample weather;                        // The weather on the screen
+WeatherSample location_weather[LOCATION_COUNT];   // The weather of every location
+int selected_location = 0;                    // The location on the screen
+char formattedTime[6] = "";   // "HH:MM" of the last update
+
+
+// The values of a WeatherSample, as an array (they are all int16_t)
+static_assert(sizeof(WeatherSample) == 8 * sizeof(int16_t), "WeatherSample must only hold int16_t values");
+int16_t* sample_values(WeatherSample& sample){
+    return reinterpret_cast<int16_t*>(&sample);
+}
+
+
+// Variables for the Hourly Forecast
+WeatherSample forecast[LOCATION_COUNT][FORECAST_HOURS];   // One sample per location and hour
+int forecast_count = 0;                   // Number of hours in the forecast (0 = no forecast)
+uint32_t forecast_start = 0;              // Unix time of the first forecast hour (the same for every location)
+uint32_t api_time = 0;                    // Unix time of the current weather (from the API)
+uint32_t api_interval = 0;                // Seconds between the API's updates of the current weather
+
+// The weather of a reply, while it is being read. It only replaces the weather above
+// once every location has been read, so a reply that breaks off half way leaves the
+// last complete fetch on the screen (and in RTC memory).
+struct FetchedWeather {
+    WeatherSample current[LOCATION_COUNT];
+    WeatherSample forecast[LOCATION_COUNT][FORECAST_HOURS];
+    int forecast_count;
+    uint32_t forecast_start;
+    uint32_t api_time;
+    uint32_t api_interval;
+};
+FetchedWeather fetched;
+
+// Variables for Conditional Fetches
+// Open-Meteo only updates the current weather every api_interval seconds (15 minutes),
+// so there is no point fetching again before the next update. If the server sends
+// an ETag or Last-Modified header, we keep it (in RTC memory) and send it back, so it
+// can answer "304 Not Modified" (with no body) when nothing has changed.
+unsigned long full_fetches = 0;           // Fetches that got new data
+unsigned long not_modified_fetches = 0;   // Fetches answered with "304 Not Modified"
+unsigned long skipped_fetches = 0;        // Fetches skipped because the data can't have changed yet
+bool update_fetch_pending = false;        // True if a fetch is waiting for the server's next update
+unsigned long update_fetch_at = 0;        // When (now_ms) to do that fetch
+unsigned long last_fetch_time = 0;        // now_ms() when the last successful fetch cycle started
+unsigned long forecast_updates = 0;       // Display updates made from the forecast (no Wi-Fi)
+
+// Variables for the Adaptive Refresh
+// The time between fetches for each speed of change, from stable to very fast. The
+// first row whose temperature and pressure limits (in tenths per hour) are not
+// exceeded is used. Every fetch picks its row again, so the interval goes back to
+// DEFAULT_FETCH_INTERVAL as soon as the weather calms down.
+struct FetchIntervalStep {
+    int16_t temp_change;       // Highest temperature change for this row
+    int16_t pressure_change;   // Highest pressure change for this row
+    uint16_t minutes;          // Time between fetches (kept within MIN_FETCH_INTERVAL and MAX_FETCH_INTERVAL)
+};
+const FetchIntervalStep fetch_interval_steps[] = {
+    { STABLE_TEMP_CHANGE,        STABLE_PRESSURE_CHANGE,        DEFAULT_FETCH_INTERVAL * 2 },   // Stable
+    { FAST_TEMP_CHANGE - 1,      FAST_PRESSURE_CHANGE - 1,      DEFAULT_FETCH_INTERVAL },       // Normal
+    { FAST_TEMP_CHANGE * 2 - 1,  FAST_PRESSURE_CHANGE * 2 - 1,  DEFAULT_FETCH_INTERVAL / 2 },   // Fast
+    { INT16_MAX,                 INT16_MAX,                     DEFAULT_FETCH_INTERVAL / 4 },   // Very fast
+};
+unsigned long fetch_interval_minutes = DEFAULT_FETCH_INTERVAL;   // From the weather alone
+WeatherSample previous_fetch;             // The weather of the fetch before the last one
+uint32_t previous_fetch_api_time = 0;     // Its unix time
+bool have_previous_fetch = false;
+unsigned long next_fetch_minutes = fetch_interval_minutes;  // After night and battery adjustments
+
+// The weather values we can ask Open-Meteo for, and which screens show them.
+// Only the values that are actually displayed are requested (and parsed),
+// which keeps the response small. Mark a value as shown to request it again.
+struct WeatherField {
+    const char* name;      // Name of the value in the Open-Meteo API
+    int16_t* value;        // Where the value is stored
+    float to_tenths;       // Multiply the API value by this to get our tenths
+    bool shown_small;      // Displayed with text size 1
+    bool shown_large;      // Displayed with text size 2
+};
+WeatherField weather_fields[] = {
+    { "temperature_2m",       &weather.temp_c,              10,       true,  true  },
+    { "apparent_temperature", &weather.feels_like_c,        10,       true,  true  },
+    { "relative_humidity_2m", &weather.humidity_percent,    10,       true,  true  },
+    { "surface_pressure",     &weather.pressure_hpa,        10,       true,  false },
+    { "wind_speed_10m",       &weather.wind_speed_mps,      10 / 3.6, true,  false },   // km/h to m/s
+    { "cloud_cover",          &weather.cloud_cover_percent, 10,       true,  false },
+    { "wind_direction_10m",   &weather.wind_direction_deg,  10,       false, false },
+    { "precipitation",        &weather.precipitation_mm,    10,       false, false },
+};
+const int weather_field_count = sizeof(weather_fields) / sizeof(weather_fields[0]);
+
+// Room for the JSON filter: "current" and "hourly", each with "time", "interval"
+// (only used by "current") and every weather field
+#define FILTER_DOCUMENT_SIZE (JSON_OBJECT_SIZE(2) + 2 * JSON_OBJECT_SIZE(2 + weather_field_count))
+
+// Room for one location of the reply, as the filter leaves it: "current" with "time",
+// "interval" and up to 8 values, "hourly" with "time" and the same values as lists of
+// FORECAST_HOURS, plus the names of them all (each is kept once) and the times when
+// they are text. The sizes come from ArduinoJson itself, so they are right on the
+// board and on a 64-bit computer.
+#define JSON_VALUE_COUNT (sizeof(WeatherSample) / sizeof(int16_t))
+#define JSON_NAMES_SIZE 192
+#define JSON_TIMES_SIZE (COMPACT_TIME_FORMAT ? 0 : (1 + (USE_FORECAST ? FORECAST_HOURS : 0)) * JSON_STRING_SIZE(16))
+#define JSON_FORECAST_SIZE (JSON_OBJECT_SIZE(1 + JSON_VALUE_COUNT) + (1 + JSON_VALUE_COUNT) * JSON_ARRAY_SIZE(FORECAST_HOURS))
+#define JSON_DOCUMENT_SIZE (JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(2 + JSON_VALUE_COUNT) \
+                            + (USE_FORECAST ? JSON_FORECAST_SIZE : 0) + JSON_NAMES_SIZE + JSON_TIMES_SIZE)
+
+// Screen layouts for the weather display (one for each text size).
+// The fixed labels are drawn only once at boot into a "prebuilt" screen.
+// Each redraw copies that screen and only draws the numbers on top of it.
+#define AFTER_PREVIOUS 255        // Column value meaning "right after the previous item"
+enum LayoutKind : uint8_t { LAYOUT_LABEL, LAYOUT_NUMBER, LAYOUT_TIME };
+struct LayoutItem {
+    LayoutKind kind;
+    uint8_t column;           // Text column (or AFTER_PREVIOUS)
+    uint8_t row;              // Text row
+    const char* label;        // The text of a label
+    const int16_t* value;     // The value of a number (in tenths)
+    uint8_t width;            // Minimum width of a number, right-aligned (like printf's "%6.1f")
+    uint8_t decimals;         // Digits after the decimal point (0 or 1)
+};
+
+
+// Make the items of a layout
+constexpr LayoutItem layout_label(uint8_t column, uint8_t row, const char* label){
+    return { LAYOUT_LABEL, column, row, label, nullptr, 0, 0 };
+}
+
+
+constexpr LayoutItem layout_number(uint8_t column, uint8_t row, const int16_t* value,
+                                   uint8_t width, uint8_t decimals){
+    return { LAYOUT_NUMBER, column, row, nullptr, value, width, decimals };
+}
+
+
+constexpr LayoutItem layout_time(uint8_t column, uint8_t row){
+    return { LAYOUT_TIME, column, row, nullptr, nullptr, 5, 0 };   // Always "HH:MM"
+}
+
+
+constexpr LayoutItem small_layout[] = {   // Text size 1 (21 columns, 8 rows)
+    layout_label(0, 0, "  Temp"),  layout_number(10, 0, &weather.temp_c, 6, 1),              layout_label(16, 0, " C"),
+    layout_label(0, 1, "  Feels"), layout_number(10, 1, &weather.feels_like_c, 6, 1),        layout_label(16, 1, " C"),
+    layout_label(0, 2, "  Hum"),   layout_number(10, 2, &weather.humidity_percent, 6, 1),    layout_label(16, 2, " %"),
+    layout_label(0, 3, "  Press"), layout_number(10, 3, &weather.pressure_hpa, 4, 1),        layout_label(AFTER_PREVIOUS, 3, " hPa"),
+    layout_label(0, 4, "  Wind"),  layout_number(10, 4, &weather.wind_speed_mps, 6, 1),      layout_label(16, 4, " mps"),
+    layout_label(0, 5, "  Cloud"), layout_number(10, 5, &weather.cloud_cover_percent, 6, 1), layout_label(16, 5, " %"),
+    layout_label(0, 7, "   (Updated "), layout_time(12, 7), layout_label(17, 7, ")"),
+};
+constexpr LayoutItem large_layout[] = {   // Text size 2 (10 columns, 4 rows)
+    layout_label(0, 0, "Temp"), layout_number(6, 0, &weather.temp_c, 2, 1),
+    layout_label(0, 1, "Feel"), layout_number(6, 1, &weather.feels_like_c, 2, 1),
+    layout_label(0, 2, "Hum"),  layout_number(5, 2, &weather.humidity_percent, 3, 0), layout_label(AFTER_PREVIOUS, 2, " %"),
+    layout_label(0, 3, "  ("),  layout_time(3, 3), layout_label(8, 3, ")"),
+};
+const int small_layout_count = sizeof(small_layout) / sizeof(small_layout[0]);
+const int large_layout_count = sizeof(large_layout) / sizeof(large_layout[0]);
+
+
+// Compile-time check that every item of a layout fits on the screen
+constexpr int layout_text_length(const char* text){
+    return *text ? 1 + layout_text_length(text + 1) : 0;
+}
+
+
+constexpr bool layout_fits(const LayoutItem* items, int count, int text_size){
+    for (int i = 0; i < count; i++) {
+        int width = items[i].kind == LAYOUT_LABEL ? layout_text_length(items[i].label) : items[i].width;
+        if (items[i].row >= 8 / text_size) return false;
+        if (items[i].column != AFTER_PREVIOUS && items[i].column + width > 21 / text_size) return false;
+    }
+    return true;
+}
+
+
+static_assert(layout_fits(small_layout, small_layout_count, 1), "small_layout does not fit on the screen");
+static_assert(layout_fits(large_layout, large_layout_count, 2), "large_layout does not fit on the screen");
+
+// The prebuilt screens (fixed labels only), made at boot by build_layout_screens()
+uint8_t small_layout_screen[SCREEN_WIDTH * SCREEN_HEIGHT / 8];
+uint8_t large_layout_screen[SCREEN_WIDTH * SCREEN_HEIGHT / 8];
+
+// History of temperature and pressure, used for the graphs.
+// To fit in RTC memory, only the oldest value is stored in full. Every newer
+// value is stored as the (small) change from the value before it. Samples are
+// HISTORY_INTERVAL minutes apart; missed samples are filled in when the next one comes.
+#define HISTORY_LENGTH 96         // Number of samples kept (96 x 30 minutes = 48 hours)
+#define HISTORY_INTERVAL 30       // Minutes between history samples
+#define HISTORY_SERIES 2          // Temperature and pressure
+struct WeatherHistory {
+    uint32_t last_time;              // Time of the newest sample (unix time)
+    int16_t first[HISTORY_SERIES];   // Oldest value of each series (in tenths)
+    int16_t last[HISTORY_SERIES];    // Newest value of each series (in tenths)
+    uint8_t start;                   // Index of the oldest sample
+    uint8_t count;                   // Number of samples
+    int8_t  change[HISTORY_SERIES][HISTORY_LENGTH];   // Change from the previous sample
+};
+
+// Data kept in RTC memory (survives resets and sleep, but not a power loss)
+// The size must be a multiple of 4 bytes.
+struct RtcData {
+    uint32_t crc32;            // Checksum of everything after this field
+    uint8_t  has_wifi;         // True if the access point info below is valid
+    uint8_t  channel;          // Wi-Fi channel of the access point
+    uint8_t  bssid[6];         // MAC address of the access point
+    uint32_t ip_address;       // Last IP address (and network settings) from DHCP
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint8_t  has_weather;      // True if the weather readings below are valid
+    char     updated_time[7];  // "HH:MM" of the last update
+    WeatherSample weather[LOCATION_COUNT];   // The last reading of every location (16 bytes each)
+    WeatherHistory history;    // Temperature and pressure of the last 48 hours
+    uint8_t  failures;         // Number of failed fetches in a row (for the retry wait)
+    char     etag[64];         // ETag header of the last full reply ("" if none)
+    char     last_modified[32];   // Last-Modified header of the last full reply ("" if none, 29 characters)
+    uint8_t  has_tls_session;  // True if the TLS session below is valid
+    uint8_t  tls_session[sizeof(BearSSL::Session)];
+};
+RtcData rtc_data;
+static_assert(sizeof(RtcData) <= 512, "RtcData does not fit in the RTC user memory (too many locations?)");
+
+// TLS session of the last HTTPS request. Offering it to the server on the
+// next request lets it resume the session instead of doing a full handshake.
+BearSSL::Session tls_session;
+
+// Fetch statistics (printed to Serial after every fetch cycle)
+size_t bytes_parsed = 0;          // Number of body bytes read from the server
+size_t json_memory_used = 0;      // Peak memory used in the JSON document
+unsigned long display_flushes = 0;   // Number of times the screen buffer was sent to the OLED
+unsigned long fetch_cycles = 0;      // Number of completed fetch cycles
+unsigned long cycle_time_ms = 0;     // How long the last fetch cycle took (in milliseconds)
+unsigned long draw_time_us = 0;      // How long the last weather screen took to draw (in microseconds)
+
+// Heap statistics (sampled during and after every fetch)
+uint32_t free_heap = 0;              // Free heap at the last sample
+uint32_t lowest_free_heap = UINT32_MAX;   // Lowest free heap seen since boot
+uint32_t largest_free_block = 0;     // Largest block we could allocate at the last sample
+uint8_t heap_fragmentation = 0;      // 100 - largest block / free heap, in percent
+uint8_t highest_fragmentation = 0;   // Highest fragmentation seen since boot
+
+// Radio-on time accounting (all in milliseconds)
+unsigned long radio_wake_time = 0;      // When the Wi-Fi was last woken up
+unsigned long radio_on_ms = 0;          // Radio-on time of the current cycle
+unsigned long total_radio_on_ms = 0;    // Radio-on time since boot
+unsigned long connect_ms = 0;           // Time spent connecting to the Wi-Fi
+unsigned long time_sync_ms = 0;         // Time spent getting the time from NTP
+unsigned long http_ms = 0;              // Time spent on the HTTPS request and parsing
+unsigned long tls_request_ms = 0;       // Time from starting the request to getting the headers (incl. TLS handshake)
+bool tls_session_offered = false;       // True if a saved TLS session was offered to the server
+unsigned long first_byte_ms = 0;        // Time from starting the request to the first body byte
+const char* body_stop_reason = "";      // Why we stopped reading the last body
+
+
+// Reads the reply body from the network with limits, so a slow or stalled link can't
+// keep the Wi-Fi on for long: it stops when no data arrives for IDLE_TIMEOUT ms, when
+// the whole body takes longer than BODY_TIMEOUT ms, or after MAX_BODY_SIZE bytes.
+// It also removes the chunk sizes from a "chunked" body, counts the bytes read, and
+// remembers when the first one arrived.
+class BodyReader : public Stream {
+    public:
+        BodyReader(WiFiClient& source, bool chunked)
+            : source(source), chunked(chunked), count(0), chunk_left(0),
+              start_time(millis()), first_byte_time(0), stop_reason(NULL) {}
+
+        int available() override {
+            if (stop_reason != NULL) return 0;
+            int n = source.available();
+            return chunked ? min(n, (int)chunk_left) : n;
+        }
+        int peek() override {
+            return wait_for_body() ? source.peek() : -1;
+        }
+        int read() override {
+            if (!wait_for_body()) return -1;
+            int c = source.read();
+            if (c >= 0) {
+                if (count == 0) first_byte_time = millis() - start_time;
+                count++;
+                if (chunked) chunk_left--;
+            }
+            return c;
+        }
+        size_t readBytes(char* buffer, size_t length) override {
+            size_t n = 0;
+            while (n < length) {
+                int c = read();
+                if (c < 0) break;
+                buffer[n++] = c;
+            }
+            return n;
+        }
+        size_t write(uint8_t) override { return 0; }   // Read-only stream
+
+        size_t bytesRead() const { return count; }
+        unsigned long firstByteTime() const { return first_byte_time; }   // ms after the reader was made
+        const char* stopReason() const { return stop_reason ? stop_reason : "stopped early"; }
+
+    private:
+        WiFiClient& source;
+        bool chunked;
+        size_t count;
+        unsigned long chunk_left;        // Bytes left in the current chunk
+        unsigned long start_time;
+        unsigned long first_byte_time;
+        const char* stop_reason;         // Why we stopped reading (NULL while still reading)
+
+        // Wait for the next byte from the network (or a reason to stop)
+        bool wait_for_source() {
+            unsigned long idle_start = millis();
+            while (source.available() == 0) {
+                if (!source.connected()) {
+                    stop_reason = "end of body";
+                } else if (millis() - idle_start >= IDLE_TIMEOUT) {
+                    stop_reason = "idle timeout";
+                } else if (millis() - start_time >= BODY_TIMEOUT) {
+                    stop_reason = "total timeout";
+                }
+                if (stop_reason != NULL) return false;
+                delay(1);
+            }
+            return true;
+        }
+
+        // Read a chunk size line ("1a2b\r\n"), skipping the end of the previous chunk
+        bool read_chunk_size() {
+            unsigned long size = 0;
+            bool have_digit = false;
+            bool in_extension = false;   // Anything after a ";" is ignored
+            while (wait_for_source()) {
+                int c = source.read();
+                if (c == '\n') {
+                    if (!have_digit) continue;   // The "\r\n" at the end of the previous chunk
+                    chunk_left = size;
+                    if (size == 0) stop_reason = "end of body";
+                    return size > 0;
+                }
+                if (c == ';') in_extension = true;
+                if (in_extension || !isxdigit(c)) continue;
+                size = size * 16 + (isdigit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+                have_digit = true;
+            }
+            return false;
+        }
+
+        // True if there is a body byte ready to read
+        bool wait_for_body() {
+            if (stop_reason != NULL) return false;
+            if (count >= MAX_BODY_SIZE) {
+                stop_reason = "size limit";
+                return false;
+            }
+            if (chunked && chunk_left == 0 && !read_chunk_size()) return false;
+            return wait_for_source();
+        }
+};
+
+// Variables for the Timer
+unsigned long previousMillis = 0;
+unsigned long interval = REFRESH_INTERVAL * 60 * 1000UL;
+
+// Variables for Light Sleep
+unsigned long sleep_offset_ms = 0;   // Time spent in light sleep that millis() did not count
+unsigned long timer_wakes = 0;       // Number of times we woke up because the timer ran out
+unsigned long button_wakes = 0;      // Number of times we woke up because of the Flash button
+volatile bool woke_up = false;       // Set by the SDK when light sleep ends
+
+// Variables for the Fetch Cycle
+// A fetch cycle (connect, get the time, fetch the weather) is done in small steps,
+// one step every time loop() runs, so the Flash button keeps working while we wait.
+enum FetchState {
+    FETCH_IDLE,            // Nothing to do until the next update
+    FETCH_START,           // Wake up the Wi-Fi and start connecting
+    FETCH_QUICK_CONNECT,   // Waiting for the saved access point
+    FETCH_CONNECT,         // Start the next normal connection attempt
+    FETCH_CONNECTING,      // Waiting for a normal connection attempt
+    FETCH_SETTLE,          // Connected, give the network stack a little time
+    FETCH_WEATHER,         // Fetch and display the weather
+    FETCH_TIME,            // Get the time from NTP (only if the clock needs it)
+    FETCH_RETRY_WAIT       // Couldn't connect, wait (with the Wi-Fi off) before trying again
+};
+FetchState fetch_state = FETCH_IDLE;
+unsigned long state_start = 0;       // When we entered the current state (millis)
+int connect_attempt = 0;             // Normal connection attempts made in this cycle
+unsigned long last_dot_time = 0;     // When we last added a progress dot to the screen
+unsigned long retry_at = 0;          // When to try connecting again (now_ms)
+FailureKind retry_reason = FAILURE_NONE;   // Why we are waiting to retry
+unsigned long total_failures = 0;    // Failed fetches since boot
+long retry_minutes_shown = -1;       // Minutes left on the retry countdown screen
+unsigned long cycle_start = 0;       // When the current fetch cycle started (now_ms)
+unsigned long max_loop_ms = 0;       // Longest run of loop() this cycle (not counting sleep)
+
+// NTPClient Configuration
+// The second argument is for the timezone offset in seconds.
+// Japan Standard Time (JST) is UTC+9, so 9 * 3600 = 32400 seconds.
+WiFiUDP ntpUDP;
+const long utcOffsetInSeconds = 9 * 3600;
+NTPClient timeClient(ntpUDP, "pool.ntp.org", utcOffsetInSeconds);
+
+// Timekeeping Configuration
+// The clock is set from the "Date" header of the weather server's response, so we
+// don't need a separate NTP request every cycle. NTP is only used when there was no
+// usable Date header and the clock may have drifted too far since it was last set.
+#define MAX_CLOCK_ERROR 30         // Sync with NTP when the clock may be off by more than this (seconds)
+#define CLOCK_ACCURACY_PPM 1000    // How far we expect our clock to drift (parts per million) after correction
+
+// Variables for Timekeeping
+uint64_t clock_time_ms = 0;          // Unix time (UTC) in milliseconds when the clock was last set
+unsigned long clock_set_ms = 0;      // now_ms() when the clock was last set
+bool clock_is_set = false;
+long clock_drift_ppm = 0;            // How much faster our clock runs than the server's (parts per million)
+long last_clock_error = 0;           // How many seconds our clock was off at the last check
+unsigned long ntp_syncs = 0;         // Number of NTP requests since boot
+
+
+// Stop the program from running (used during fatal errors)
+void halt_program_execution(){
+    while(true) {
+        delay(1000);
+    };
+}
+
+
+// True if a weather value is shown on any screen (and so needs to be fetched)
+bool field_is_needed(const WeatherField& field){
+    return field.shown_small || field.shown_large;
+}
+
+
+// Where a weather value lives inside a WeatherSample
+int field_index(const WeatherField& field){
+    return field.value - sample_values(weather);
+}
+
+
+// Build the Open-Meteo request path, asking only for the values we display
+void build_server_path(){
+    // All the locations in one request: "latitude=1,2,3&longitude=4,5,6"
+    strcpy(server_path, "/v1/forecast?latitude=");
+    for (int i = 0; i < LOCATION_COUNT; i++) {
+        if (i > 0) strncat(server_path, ",", sizeof(server_path) - strlen(server_path) - 1);
+        strncat(server_path, locations[i].latitude, sizeof(server_path) - strlen(server_path) - 1);
+    }
+    strncat(server_path, "&longitude=", sizeof(server_path) - strlen(server_path) - 1);
+    for (int i = 0; i < LOCATION_COUNT; i++) {
+        if (i > 0) strncat(server_path, ",", sizeof(server_path) - strlen(server_path) - 1);
+        strncat(server_path, locations[i].longitude, sizeof(server_path) - strlen(server_path) - 1);
+    }
+    strncat(server_path, "&current=", sizeof(server_path) - strlen(server_path) - 1);
+
+    bool first = true;
+    for (int i = 0; i < weather_field_count; i++) {
+        if (!field_is_needed(weather_fields[i])) continue;
+        if (!first) strncat(server_path, ",", sizeof(server_path) - strlen(server_path) - 1);
+        strncat(server_path, weather_fields[i].name, sizeof(server_path) - strlen(server_path) - 1);
+        first = false;
+    }
+
+    size_t length = strlen(server_path);
+    snprintf(server_path + length, sizeof(server_path) - length, "&timezone=%s&models=%s%s",
+             timezone_name, weather_model, (COMPACT_TIME_FORMAT || USE_FORECAST) ? "&timeformat=unixtime" : "");
+
+    // Ask for the same values, hour by hour, for the next few hours
+    if (USE_FORECAST) {
+        length = strlen(server_path);
+        snprintf(server_path + length, sizeof(server_path) - length, "&forecast_hours=%d&hourly=", FORECAST_HOURS);
+        first = true;
+        for (int i = 0; i < weather_field_count; i++) {
+            if (!field_is_needed(weather_fields[i])) continue;
+            if (!first) strncat(server_path, ",", sizeof(server_path) - strlen(server_path) - 1);
+            strncat(server_path, weather_fields[i].name, sizeof(server_path) - strlen(server_path) - 1);
+            first = false;
+        }
+    }
+
+    Serial.printf("Request path: %s\n", server_path);
+}
+
+
+// Calculate a CRC32 checksum (used to check the data in RTC memory)
+uint32_t calculate_crc32(const uint8_t* data, size_t length){
+    uint32_t crc = 0xffffffff;
+    while (length--) {
+        uint8_t c = *data++;
+        for (uint32_t i = 0x80; i > 0; i >>= 1) {
+            bool bit = crc & 0x80000000;
+            if (c & i) bit = !bit;
+            crc <<= 1;
+            if (bit) crc ^= 0x04c11db7;
+        }
+    }
+    return crc;
+}
+
+
+// Save rtc_data to RTC memory (with a fresh checksum)
+void save_rtc_data(){
+    rtc_data.crc32 = calculate_crc32((uint8_t*)&rtc_data + 4, sizeof(rtc_data) - 4);
+    ESP.rtcUserMemoryWrite(0, (uint32_t*)&rtc_data, sizeof(rtc_data));
+}
+
+
+// Load rtc_data from RTC memory. If the checksum is wrong (e.g. after a
+// power loss), start over with empty data.
+void load_rtc_data(){
+    if (!ESP.rtcUserMemoryRead(0, (uint32_t*)&rtc_data, sizeof(rtc_data)) ||
+        rtc_data.crc32 != calculate_crc32((uint8_t*)&rtc_data + 4, sizeof(rtc_data) - 4)) {
+        memset(&rtc_data, 0, sizeof(rtc_data));
+        return;
+    }
+
+    // Restore the last weather reading, so it can be displayed right away
+    if (rtc_data.has_weather) {
+        memcpy(location_weather, rtc_data.weather, sizeof(location_weather));
+        weather = location_weather[selected_location];
+        strlcpy(formattedTime, rtc_data.updated_time, sizeof(formattedTime));
+    }
+
+    // Restore the TLS session, so the first request after a reset can resume it
+    if (rtc_data.has_tls_session) {
+        memcpy((void*)&tls_session, rtc_data.tls_session, sizeof(tls_session));
+    }
+}
+
+
+// Remember the access point we are connected to, for a quick reconnect next time
+void save_wifi_to_rtc(){
+    rtc_data.has_wifi = true;
+    rtc_data.channel = WiFi.channel();
+    memcpy(rtc_data.bssid, WiFi.BSSID(), 6);
+    rtc_data.ip_address = WiFi.localIP();
+    rtc_data.gateway = WiFi.gatewayIP();
+    rtc_data.subnet = WiFi.subnetMask();
+    rtc_data.dns = WiFi.dnsIP();
+    save_rtc_data();
+}
+
+
+// Remember the TLS session of the last request
+void save_tls_session_to_rtc(){
+    rtc_data.has_tls_session = true;
+    memcpy(rtc_data.tls_session, (const void*)&tls_session, sizeof(tls_session));
+    save_rtc_data();
+}
+
+
+// Remember the latest weather reading
+void save_weather_to_rtc(){
+    rtc_data.has_weather = true;
+    strncpy(rtc_data.updated_time, formattedTime, sizeof(rtc_data.updated_time) - 1);
+    rtc_data.updated_time[sizeof(rtc_data.updated_time) - 1] = '\0';
+    memcpy(rtc_data.weather, location_weather, sizeof(rtc_data.weather));
+    save_rtc_data();
+}
+
+
+// Send the screen buffer to the OLED (and count how often we do it)
+void flush_display(){
+    display_flushes++;
+    display.displayChanges();
+}
+
+
+// Wake up the Wi-Fi (and start timing how long it stays on)
+void radio_wake(){
+    WiFi.forceSleepWake();
+    radio_wake_time = millis();
+}
+
+
+// Put the Wi-Fi to sleep (and add up how long it was on)
+void radio_sleep(){
+    WiFi.forceSleepBegin();
+    unsigned long on_time = millis() - radio_wake_time;
+    radio_on_ms += on_time;
+    total_radio_on_ms += on_time;
+}
+
+
+// Measure how much heap is free, and how broken up it is
+void sample_heap(){
+    free_heap = ESP.getFreeHeap();
+    largest_free_block = ESP.getMaxFreeBlockSize();
+    heap_fragmentation = ESP.getHeapFragmentation();
+    if (free_heap < lowest_free_heap) lowest_free_heap = free_heap;
+    if (heap_fragmentation > highest_fragmentation) highest_fragmentation = heap_fragmentation;
+}
+
+
+// Print the statistics of the last fetch cycle to Serial
+void print_cycle_stats(){
+    Serial.printf("Cycle %lu: %lu ms, %lu display flushes, %u bytes parsed\n",
+                  fetch_cycles, cycle_time_ms, display_flushes, (unsigned int)bytes_parsed);
+    Serial.printf("Display: %lu I2C bytes for the last update, %lu since boot\n",
+                  display.bytes_sent_last, display.bytes_sent_total);
+
+    // Estimate the energy used until the next fetch. That is next_fetch_minutes, not
+    // interval: with a forecast the display is moved along several times in between.
+    double radio_off_ms = next_fetch_minutes * 60000.0 - radio_on_ms;
+    if (radio_off_ms < 0) radio_off_ms = 0;
+    double idle_current_ma = USE_LIGHT_SLEEP ? LIGHT_SLEEP_CURRENT_MA : RADIO_OFF_CURRENT_MA;
+    double cycle_mah = (radio_on_ms * RADIO_ON_CURRENT_MA + radio_off_ms * idle_current_ma) / 3600000.0;
+    double cycle_hours = (radio_on_ms + radio_off_ms) / 3600000.0;
+    double battery_hours = BATTERY_CAPACITY_MAH / (cycle_mah / cycle_hours);
+
+    Serial.printf("Clock off by %ld s at the last check, drift %ld ppm, %lu NTP syncs\n",
+                  last_clock_error, clock_drift_ppm, ntp_syncs);
+    Serial.printf("Radio on %lu ms (connect %lu, time %lu, fetch %lu), total %lu ms\n",
+                  radio_on_ms, connect_ms, time_sync_ms, http_ms, total_radio_on_ms);
+    Serial.printf("TLS handshake and request %lu ms (saved session %s)\n",
+                  tls_request_ms, tls_session_offered ? "offered" : "not available");
+    Serial.printf("Estimated %.3f mAh per cycle, %.0f hours of battery life\n",
+                  cycle_mah, battery_hours);
+    Serial.printf("Woke up %lu times for the timer, %lu times for the button\n",
+                  timer_wakes, button_wakes);
+    Serial.printf("%lu display updates from the forecast, %d forecast hours\n",
+                  forecast_updates, forecast_count);
+    Serial.printf("Fetches: %lu full, %lu not modified, %lu skipped (server updates every %lu s)\n",
+                  full_fetches, not_modified_fetches, skipped_fetches, (unsigned long)api_interval);
+    Serial.printf("Heap %u bytes free (lowest %u), largest block %u, fragmentation %u%% (highest %u%%)\n",
+                  free_heap, lowest_free_heap, largest_free_block, heap_fragmentation, highest_fragmentation);
+    Serial.printf("Longest loop() run %lu ms, %lu failed fetches\n", max_loop_ms, total_failures);
+}
+
+
+// The current time in milliseconds, including time spent in light sleep
+unsigned long now_ms(){
+    return millis() + sleep_offset_ms;
+}
+
+
+// The current unix time (UTC) in milliseconds, corrected for how fast our clock is
+// known to drift
+uint64_t clock_now_ms(){
+    int64_t elapsed_ms = now_ms() - clock_set_ms;
+    elapsed_ms -= elapsed_ms * clock_drift_ppm / 1000000;
+    return clock_time_ms + elapsed_ms;
+}
+
+
+// The current unix time (UTC)
+uint32_t clock_now(){
+    return clock_now_ms() / 1000;
+}
+
+
+// Set the clock from a time we got from a server.
+// Comparing it with our own clock tells us how fast our clock drifts.
+void set_clock(uint32_t server_time){
+    // The server's time is cut down to whole seconds, so the real time is anywhere in
+    // the next second: take the middle of it. Otherwise our clock would be set half a
+    // second slow on average, and the drift estimate would be biased by it.
+    uint64_t server_ms = (uint64_t)server_time * 1000 + 500;
+    if (clock_is_set) {
+        int64_t error_ms = (int64_t)(clock_now_ms() - server_ms);   // Negative if our clock is behind
+        last_clock_error = (error_ms + (error_ms < 0 ? -500 : 500)) / 1000;   // Rounded to whole seconds
+        long elapsed_ms = now_ms() - clock_set_ms;
+        // The server's time is only accurate to a second, so only measure the drift over
+        // a long enough time, and only correct half of it each time to smooth it out
+        if (elapsed_ms >= 600000L) {
+            clock_drift_ppm += error_ms * 1000000 / elapsed_ms / 2;
+            clock_drift_ppm = constrain(clock_drift_ppm, -50000L, 50000L);
+        }
+    }
+    clock_time_ms = server_ms;
+    clock_set_ms = now_ms();
+    clock_is_set = true;
+}
+
+
+// True if the clock may be too far off (or was never set), and needs an NTP sync
+bool clock_needs_ntp(){
+    if (!clock_is_set) return true;
+    unsigned long since_set_s = (now_ms() - clock_set_ms) / 1000;
+    return (uint64_t)since_set_s * CLOCK_ACCURACY_PPM / 1000000 > MAX_CLOCK_ERROR;
+}
+
+
+// Read the time from an HTTP "Date" header, like "Sun, 06 Nov 1994 08:49:37 GMT"
+bool parse_http_date(const char* text, uint32_t& unix_time){
+    char month_name[4];
+    int day, year, hour, minute, second;
+    if (sscanf(text, "%*[^,], %d %3s %d %d:%d:%d", &day, month_name, &year, &hour, &minute, &second) != 6) {
+        return false;
+    }
+    const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    const char* found = strstr(months, month_name);
+    if (found == NULL || strlen(month_name) != 3 || year < 1970) return false;
+    int month = (found - months) / 3 + 1;
+
+    // Count the days since 1970-01-01 (treating March as the first month of the year,
+    // so the leap day comes last)
+    if (month <= 2) year--;
+    int month_from_march = month > 2 ? month - 3 : month + 9;
+    long days = 365L * year + year / 4 - year / 100 + year / 400
+              + (153 * month_from_march + 2) / 5 + day - 1 - 719468;
+    unix_time = days * 86400 + hour * 3600L + minute * 60 + second;
+    return true;
+}
+
+
+// Set formattedTime ("HH:MM", local time) from a unix time
+void set_formatted_time(uint32_t unix_time){
+    uint32_t local_time = unix_time + utcOffsetInSeconds;
+    snprintf(formattedTime, sizeof(formattedTime), "%02u:%02u",
+             (unsigned int)(local_time / 3600 % 24), (unsigned int)(local_time / 60 % 60));
+}
+
+
+// Called by the SDK when light sleep ends (timer or button)
+void light_sleep_wakeup(){
+    woke_up = true;
+}
+
+
+// Put the CPU into light sleep until the timer runs out or the Flash button is pressed.
+// RAM is kept during light sleep, so all the weather data is still there afterwards.
+void light_sleep(unsigned long sleep_ms){
+    if (sleep_ms > MAX_LIGHT_SLEEP_MS) sleep_ms = MAX_LIGHT_SLEEP_MS;
+    if (sleep_ms < 10) return;   // Not worth going to sleep
+
+    Serial.flush();   // Let Serial finish sending before the clocks stop
+
+    // The RTC timer keeps running while we sleep, so use it to measure the sleep
+    uint32_t rtc_start = system_get_rtc_time();
+    uint32_t rtc_period = system_rtc_clock_cali_proc();   // Microseconds per tick (x4096)
+    unsigned long millis_start = millis();
+
+    // Take the Wi-Fi out of modem sleep, and set up light sleep instead
+    wifi_fpm_do_wakeup();
+    wifi_fpm_close();
+    wifi_set_opmode_current(NULL_MODE);
+    wifi_fpm_set_sleep_type(LIGHT_SLEEP_T);
+    wifi_fpm_open();
+    gpio_pin_wakeup_enable(GPIO_ID_PIN(buttonPin), GPIO_PIN_INTR_LOLEVEL);
+    wifi_fpm_set_wakeup_cb(light_sleep_wakeup);
+
+    // The chip goes to sleep the next time it is idle (during delay())
+    woke_up = false;
+    wifi_fpm_do_sleep(sleep_ms * 1000);
+    while (!woke_up && (millis() - millis_start) < sleep_ms + 100) {
+        delay(10);
+    }
+
+    gpio_pin_wakeup_disable();
+    wifi_fpm_close();
+
+    // Add any sleep time that millis() did not see to our own clock
+    uint32_t rtc_ticks = system_get_rtc_time() - rtc_start;
+    unsigned long slept_ms = (unsigned long)(((uint64_t)rtc_ticks * rtc_period) >> 12) / 1000;
+    unsigned long counted_ms = millis() - millis_start;
+    if (slept_ms > counted_ms) sleep_offset_ms += slept_ms - counted_ms;
+
+    if (digitalRead(buttonPin) == LOW) {
+        button_wakes++;
+    } else {
+        timer_wakes++;
+    }
+}
+
+
+// Function to display single-line messages
+void display_message(const char* MESSAGE, const int MESSAGE_TEXT_SIZE, const int MESSAGE_DURATION){
+    display.clearDisplay();
+    display.setCursor(0,0);
+    display.setTextSize(MESSAGE_TEXT_SIZE);
+    display.setTextColor(SSD1306_WHITE);
+    display.printf("%s", MESSAGE);
+    flush_display();
+    showing_status = true;
+    delay(MESSAGE_DURATION * 1000);   // Convert input seconds to milliseconds
+}
+
+
+// Turn a value in tenths into a whole number. Halves are rounded to the even number
+// (72.5 becomes 72, 73.5 becomes 74), the same as printf("%.0f") does.
+long tenths_to_whole(long tenths){
+    bool negative = tenths < 0;
+    long magnitude = negative ? -tenths : tenths;
+    long whole = magnitude / 10;
+    int rest = magnitude % 10;
+    if (rest > 5 || (rest == 5 && whole % 2 == 1)) whole++;
+    return negative ? -whole : whole;
+}
+
+
+// Fast number formatting (no printf, no floats): 235 with 1 decimal becomes "23.5".
+// The text is padded with spaces on the left up to the given width.
+void format_fixed(char* text, long scaled, int decimals, int width){
+    char digits[16];   // Built backwards, starting with the last digit
+    int n = 0;
+    int digit_count = 0;
+    bool negative = scaled < 0;
+    unsigned long remaining = negative ? -scaled : scaled;
+
+    do {
+        if (decimals > 0 && digit_count == decimals) digits[n++] = '.';
+        digits[n++] = '0' + remaining % 10;
+        remaining /= 10;
+        digit_count++;
+    } while (remaining > 0 || digit_count <= decimals);   // Always at least one digit before the point
+    if (negative) digits[n++] = '-';
+
+    int length = 0;
+    while (width-- > n) text[length++] = ' ';
+    while (n > 0) text[length++] = digits[--n];
+    text[length] = '\0';
+}
+
+
+// Move the cursor to an item's place on the screen (unless it just follows the previous item)
+void move_to_layout_item(const LayoutItem& item, int text_size){
+    if (item.column != AFTER_PREVIOUS) {
+        display.setCursor(item.column * 6 * text_size, item.row * 8 * text_size);
+    }
+}
+
+
+// Draw the fixed labels of both layouts once, and keep the results
+void build_layout_screens(){
+    display.setTextColor(SSD1306_WHITE);
+    for (int text_size = 1; text_size <= 2; text_size++) {
+        const LayoutItem* items = text_size == 1 ? small_layout : large_layout;
+        int count = text_size == 1 ? small_layout_count : large_layout_count;
+
+        display.clearDisplay();
+        display.setTextSize(text_size);
+        for (int i = 0; i < count; i++) {
+            if (items[i].kind == LAYOUT_LABEL && items[i].column != AFTER_PREVIOUS) {
+                move_to_layout_item(items[i], text_size);
+                display.print(items[i].label);
+            }
+        }
+        memcpy(text_size == 1 ? small_layout_screen : large_layout_screen, display.getBuffer(), sizeof(small_layout_screen));
+    }
+    display.clearDisplay();
+
+    Serial.printf("Layouts: %u bytes of layout tables, %u bytes of prebuilt screens\n",
+                  (unsigned int)(sizeof(small_layout) + sizeof(large_layout)),
+                  (unsigned int)(sizeof(small_layout_screen) + sizeof(large_layout_screen)));
+}
+
+
+// Draw a layout: start from its prebuilt screen, then draw the numbers (and anything that moves)
+void draw_layout(const LayoutItem* items, int count, const uint8_t* prebuilt_screen, int text_size){
+    memcpy(display.getBuffer(), prebuilt_screen, SCREEN_WIDTH * SCREEN_HEIGHT / 8);
+    display.setTextSize(text_size);
+    display.setTextColor(SSD1306_WHITE);
+
+    char text[16];
+    for (int i = 0; i < count; i++) {
+        const LayoutItem& item = items[i];
+        if (item.kind == LAYOUT_LABEL && item.column != AFTER_PREVIOUS) continue;   // Already on the prebuilt screen
+
+        move_to_layout_item(item, text_size);
+        if (item.kind == LAYOUT_LABEL) {
+            display.print(item.label);
+        } else if (item.kind == LAYOUT_NUMBER) {
+            long value = item.decimals > 0 ? *item.value : tenths_to_whole(*item.value);
+            format_fixed(text, value, item.decimals, item.width);
+            display.print(text);
+        } else {
+            display.print(formattedTime);
+        }
+    }
+}
+
+
+// History graphs
+// Temperature is drawn in rows 16-39 and pressure in rows 40-63, one column per sample.
+// The graphs are kept in their own screen buffer, so a new sample only has to
+// draw one new line segment (and scroll the graph once it is full).
+#define GRAPH_LEFT 32             // The graphs start at this column (the labels go on the left)
+#define GRAPH_HEIGHT 24           // Rows per graph
+uint8_t history_screen[SCREEN_WIDTH * SCREEN_HEIGHT / 8];
+bool history_screen_ready = false;   // False if history_screen needs to be drawn from scratch
+int16_t graph_min[HISTORY_SERIES];   // The value range each graph was drawn with
+int16_t graph_max[HISTORY_SERIES];
+
+
+// Get the history back as full values, oldest first
+void decode_history(int16_t values[HISTORY_SERIES][HISTORY_LENGTH]){
+    const WeatherHistory& history = rtc_data.history;
+    for (int series = 0; series < HISTORY_SERIES; series++) {
+        int16_t value = history.first[series];
+        for (int i = 0; i < history.count; i++) {
+            if (i > 0) value += history.change[series][(history.start + i) % HISTORY_LENGTH];
+            values[series][i] = value;
+        }
+    }
+}
+
+
+// Which row a value is drawn in
+int graph_row(int series, int16_t value){
+    int top = 16 + series * GRAPH_HEIGHT;
+    int range = graph_max[series] - graph_min[series];
+    int offset = (long)(value - graph_min[series]) * (GRAPH_HEIGHT - 3) / range;
+    return top + GRAPH_HEIGHT - 2 - constrain(offset, 0, GRAPH_HEIGHT - 3);
+}
+
+
+// Draw the latest value of each series next to its graph
+void draw_history_labels(){
+    char text[16];
+    display.fillRect(0, 16, GRAPH_LEFT, SCREEN_HEIGHT - 16, SSD1306_BLACK);
+    display.setTextSize(1);
+    display.setTextColor(SSD1306_WHITE);
+
+    display.setCursor(0, 16);
+    display.print("Temp");
+    format_fixed(text, rtc_data.history.last[0], 1, 0);
+    display.setCursor(0, 24);
+    display.print(text);
+
+    display.setCursor(0, 40);
+    display.print("Pres");
+    format_fixed(text, tenths_to_whole(rtc_data.history.last[1]), 0, 0);
+    display.setCursor(0, 48);
+    display.print(text);
+}
+
+
+// Draw the whole history screen from scratch into history_screen
+void build_history_screen(){
+    static int16_t values[HISTORY_SERIES][HISTORY_LENGTH];
+    const WeatherHistory& history = rtc_data.history;
+    char low[8];
+    char high[8];
+
+    display.clearDisplay();
+    display.setTextSize(1);
+    display.setTextColor(SSD1306_WHITE);
+    display.setCursor(0, 0);
+
+    if (history.count == 0) {
+        display.print(" No history yet");
+        memcpy(history_screen, display.getBuffer(), sizeof(history_screen));
+        return;   // Not "ready", so it is drawn again once there is a sample
+    }
+
+    decode_history(values);
+
+    // Work out the value range of each graph, with some room above and below
+    // so new samples usually still fit (at least 2.0 C or 2 hPa from top to bottom)
+    for (int series = 0; series < HISTORY_SERIES; series++) {
+        int16_t lowest = values[series][0];
+        int16_t highest = values[series][0];
+        for (int i = 1; i < history.count; i++) {
+            if (values[series][i] < lowest) lowest = values[series][i];
+            if (values[series][i] > highest) highest = values[series][i];
+        }
+        int margin = max(20 - (highest - lowest), 0) / 2 + (highest - lowest) / 8 + 5;
+        graph_min[series] = lowest - margin;
+        graph_max[series] = highest + margin;
+    }
+
+    // The ranges go in the top (orange) area
+    format_fixed(low, graph_min[0], 1, 0);
+    format_fixed(high, graph_max[0], 1, 0);
+    display.printf("T %s - %s C\n", low, high);
+    format_fixed(low, tenths_to_whole(graph_min[1]), 0, 0);
+    format_fixed(high, tenths_to_whole(graph_max[1]), 0, 0);
+    display.printf("P %s - %s hPa\n", low, high);
+
+    draw_history_labels();
+
+    // Draw the graphs, one column per sample
+    for (int series = 0; series < HISTORY_SERIES; series++) {
+        display.drawPixel(GRAPH_LEFT, graph_row(series, values[series][0]), SSD1306_WHITE);
+        for (int i = 1; i < history.count; i++) {
+            display.drawLine(GRAPH_LEFT + i - 1, graph_row(series, values[series][i - 1]),
+                             GRAPH_LEFT + i, graph_row(series, values[series][i]), SSD1306_WHITE);
+        }
+    }
+
+    memcpy(history_screen, display.getBuffer(), sizeof(history_screen));
+    history_screen_ready = true;
+}
+
+
+// Add the newest sample to history_screen without redrawing the whole graph
+void update_history_screen(const int16_t previous[HISTORY_SERIES], bool scrolled){
+    const WeatherHistory& history = rtc_data.history;
+
+    // If a value is outside the range of its graph, draw everything again next time
+    for (int series = 0; series < HISTORY_SERIES; series++) {
+        if (history.last[series] < graph_min[series] || history.last[series] > graph_max[series]) {
+            history_screen_ready = false;
+            return;
+        }
+    }
+
+    uint8_t* frame = display.getBuffer();
+    memcpy(frame, history_screen, sizeof(history_screen));
+
+    // Once the graph is full, move it one column to the left to make room
+    if (scrolled) {
+        for (int page = 2; page < SCREEN_HEIGHT / 8; page++) {
+            uint8_t* row = frame + page * SCREEN_WIDTH;
+            memmove(row + GRAPH_LEFT, row + GRAPH_LEFT + 1, SCREEN_WIDTH - GRAPH_LEFT - 1);
+            row[SCREEN_WIDTH - 1] = 0;
+        }
+    }
+
+    // Draw the line from the previous sample to the new one
+    int x = GRAPH_LEFT + history.count - 1;
+    for (int series = 0; series < HISTORY_SERIES; series++) {
+        if (history.count > 1) {
+            display.drawLine(x - 1, graph_row(series, previous[series]), x, graph_row(series, history.last[series]), SSD1306_WHITE);
+        } else {
+            display.drawPixel(x, graph_row(series, history.last[series]), SSD1306_WHITE);
+        }
+    }
+
+    draw_history_labels();
+    memcpy(history_screen, frame, sizeof(history_screen));
+}
+
+
+// Add one sample to the end of the history, dropping the oldest one if it is full.
+// Returns true if the oldest sample was dropped.
+bool push_history_sample(const int16_t sample[HISTORY_SERIES]){
+    WeatherHistory& history = rtc_data.history;
+    bool scrolled = false;
+
+    if (history.count == 0) {
+        for (int series = 0; series < HISTORY_SERIES; series++) {
+            history.first[series] = sample[series];
+            history.last[series] = sample[series];
+        }
+        history.start = 0;
+        history.count = 1;
+        return false;
+    }
+
+    // If the history is full, drop the oldest sample
+    if (history.count == HISTORY_LENGTH) {
+        history.start = (history.start + 1) % HISTORY_LENGTH;
+        history.count--;
+        for (int series = 0; series < HISTORY_SERIES; series++) {
+            history.first[series] += history.change[series][history.start];
+        }
+        scrolled = true;
+    }
+
+    // Store the change since the last sample (limited to what fits in a byte)
+    int index = (history.start + history.count) % HISTORY_LENGTH;
+    for (int series = 0; series < HISTORY_SERIES; series++) {
+        int change = constrain(sample[series] - history.last[series], -128, 127);
+        history.change[series][index] = change;
+        history.last[series] += change;
+    }
+    history.count++;
+    return scrolled;
+}
+
+
+// Add the latest reading to the history, at most once every HISTORY_INTERVAL minutes.
+// "time" is the time of the reading (unix time). If samples were missed (the
+// display was reset, or couldn't fetch), the gap is filled in with a straight line
+// so that every column of the graph is still HISTORY_INTERVAL minutes.
+void add_to_history(uint32_t time){
+    const uint32_t step = HISTORY_INTERVAL * 60UL;
+    WeatherHistory& history = rtc_data.history;
+    const WeatherSample& home = location_weather[0];
+    const int16_t sample[HISTORY_SERIES] = { home.temp_c, home.pressure_hpa };
+    int16_t previous[HISTORY_SERIES] = { history.last[0], history.last[1] };
+
+    // Count how many samples are due (a minute early is close enough). If the clock
+    // went backwards, start counting from this sample instead.
+    bool counting = history.count > 0 && time + step >= history.last_time;
+    uint32_t samples = 1;
+    if (counting) {
+        if (time + 60 < history.last_time + step) return;
+        samples = (time + 60 - history.last_time) / step;
+    }
+    if (samples > HISTORY_LENGTH) {
+        history.count = 0;   // Everything we have is too old
+        samples = 1;
+        counting = false;
+    }
+
+    // Fill in the missed samples, then add this one
+    bool scrolled = false;
+    for (uint32_t i = 1; i < samples; i++) {
+        int16_t filled[HISTORY_SERIES];
+        for (int series = 0; series < HISTORY_SERIES; series++) {
+            filled[series] = previous[series] + (long)(sample[series] - previous[series]) * (long)i / (long)samples;
+        }
+        scrolled |= push_history_sample(filled);
+    }
+    scrolled |= push_history_sample(sample);
+
+    // Keep the samples exactly one step apart, so a late sample doesn't move the next ones
+    history.last_time = counting ? history.last_time + samples * step : time;
+    save_rtc_data();
+
+    if (history_screen_ready) {
+        if (samples > 1) {
+            history_screen_ready = false;   // More than one new column: draw everything again
+        } else {
+            update_history_screen(previous, scrolled);
+        }
+    }
+}
+
+
+// Show the history screen
+void display_history(){
+    if (!history_screen_ready) {
+        build_history_screen();
+    }
+    memcpy(display.getBuffer(), history_screen, sizeof(history_screen));
+    flush_display();
+}
+
+
+// Draw the weather screen of the selected text size from the prebuilt layouts
+void draw_weather_layouts(){
+    if (user_selected_text_size == 1) {   // If the text should be normal size
+        draw_layout(small_layout, small_layout_count, small_layout_screen, 1);
+        if (LOCATION_COUNT > 1) {         // Show which location this is on the empty row
+            display.setCursor(2 * 6, 6 * 8);
+            display.print(locations[selected_location].name);
+        }
+    } else {                              // If the text should be double size
+        draw_layout(large_layout, large_layout_count, large_layout_screen, 2);
+        if (LOCATION_COUNT > 1) {         // Show the number of the location (1 = home) before the time
+            display.setCursor(0, 3 * 16);
+            display.print(selected_location + 1);
+        }
+    }
+}
+
+
+// The old way: draw everything with printf (and floats)
+void draw_weather_printf(){
+    display.clearDisplay();
+    display.setCursor(0,0);
+    display.setTextSize(user_selected_text_size);
+    display.setTextColor(SSD1306_WHITE);
+
+    if (user_selected_text_size == 1) {   // If the text should be normal size
+        display.printf("  Temp    %6.1f C\n", weather.temp_c / 10.0);
+        display.printf("  Feels   %6.1f C\n", weather.feels_like_c / 10.0);
+        display.printf("  Hum     %6.1f %%\n", weather.humidity_percent / 10.0);
+        display.printf("  Press   %4.1f hPa\n", weather.pressure_hpa / 10.0);
+        display.printf("  Wind    %6.1f mps\n", weather.wind_speed_mps / 10.0);
+        display.printf("  Cloud   %6.1f %%\n", weather.cloud_cover_percent / 10.0);
+        display.printf("  %s\n", LOCATION_COUNT > 1 ? locations[selected_location].name : "");
+        display.printf("   (Updated %s)\n", formattedTime);
+
+    } else {   // If the text should be double size
+        display.printf("Temp  %2.1f\n", weather.temp_c / 10.0);
+        display.printf("Feel  %2.1f\n", weather.feels_like_c / 10.0);
+        display.printf("Hum  %3.0f %%\n", weather.humidity_percent / 10.0);   // Room for "100 %"
+        if (LOCATION_COUNT > 1) {
+            display.printf("%d (%s) \n", selected_location + 1, formattedTime);
+        } else {
+            display.printf("  (%s) \n", formattedTime);
+        }
+    }
+}
+
+
+// Function to Display the Pre-fetched Weather Data
+void display_weather(){
+    showing_status = false;   // The weather replaces any status message
+
+    if (showing_history) {
+        display_history();
+        return;
+    }
+
+    unsigned long draw_start = micros();
+    if (USE_PREBUILT_LAYOUTS) {
+        draw_weather_layouts();
+    } else {
+        draw_weather_printf();
+    }
+    draw_time_us = micros() - draw_start;
+    flush_display();
+
+    Serial.printf("Redraw took %lu us (%s, glyph cache %s), %lu I2C bytes\n",
+                  draw_time_us, USE_PREBUILT_LAYOUTS ? "prebuilt layouts" : "printf",
+                  USE_GLYPH_CACHE ? "on" : "off", display.bytes_sent_last);
+}
+
+
+// Move the fetch cycle on to its next step
+void set_fetch_state(FetchState state) {
+    fetch_state = state;
+    state_start = millis();
+}
+
+
+// Wake up the Wi-Fi and start connecting
+void start_connecting() {
+    // Wake up Wi-Fi and wait for it to turn on
+    radio_wake();
+    delay(50);
+
+    // Completely turn off the Wi-Fi before trying to reconnect
+    WiFi.mode(WIFI_OFF);
+    WiFi.disconnect(true);
+    WiFi.mode(WIFI_STA);    // Set the Wi-Fi mode back to station mode
+    connect_attempt = 0;
+
+    // Quick connect: go straight to the access point (and channel) we used last time,
+    // which skips the channel scan. If it doesn't work, fall back to a normal connect.
+    if (rtc_data.has_wifi) {
+        if (REUSE_IP_ADDRESS) {
+            WiFi.config(IPAddress(rtc_data.ip_address), IPAddress(rtc_data.gateway),
+                        IPAddress(rtc_data.subnet), IPAddress(rtc_data.dns));
+        }
+        WiFi.begin(ssid, password, rtc_data.channel, rtc_data.bssid, true);
+        display_message(" Connecting to WiFi \n  (quick connect)", 1, 0);
+        set_fetch_state(FETCH_QUICK_CONNECT);
+    } else {
+        set_fetch_state(FETCH_CONNECT);
+    }
+}
+
+
+// The saved access point didn't work, so forget it and do a normal connect
+void forget_saved_access_point() {
+    rtc_data.has_wifi = false;
+    save_rtc_data();
+    WiFi.disconnect();
+    if (REUSE_IP_ADDRESS) {
+        WiFi.config(IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));   // Back to DHCP
+    }
+}
+
+
+// Start a normal connection attempt (maxAttempts configured at top of program)
+void start_connect_attempt() {
+    connect_attempt++;
+    WiFi.begin(ssid, password);
+    display.clearDisplay();
+    display.setCursor(0,0);
+    display.setTextSize(1);
+    display.printf(" Connecting to WiFi \n");
+    display.printf("   Attempt %d of %d\n", connect_attempt, maxAttempts);
+    flush_display();
+    showing_status = true;
+    last_dot_time = millis();
+    set_fetch_state(FETCH_CONNECTING);
+}
+
+
+// Show how many minutes are left before we retry (redrawn when the number changes)
+void show_retry_countdown() {
+    long minutes_left = (retry_at - now_ms() + 59999) / 60000;
+    if (minutes_left == retry_minutes_shown) return;
+    retry_minutes_shown = minutes_left;
+
+    char message[128];
+    snprintf(message, sizeof(message), "%s\n\n  Waiting %ld minute%s\n   before retrying\n",
+             retry_policies[retry_reason].message, minutes_left, minutes_left == 1 ? " " : "s");
+    display_message(message, 1, 0);
+}
+
+
+// Something went wrong: work out how long to wait before trying again, and start waiting
+void schedule_retry(FailureKind reason) {
+    if (rtc_data.failures < 255) rtc_data.failures++;
+    save_rtc_data();   // Keep counting after a reset, so a reset doesn't start the backoff over
+    total_failures++;
+
+    // Double the wait after every failure in a row, up to the limit
+    const RetryPolicy& policy = retry_policies[reason];
+    unsigned long minutes = policy.first_delay;
+    for (int i = 1; i < rtc_data.failures && minutes < policy.max_delay; i++) {
+        minutes *= 2;
+    }
+    if (minutes > policy.max_delay) minutes = policy.max_delay;
+
+    // Add or take away a random part of the wait
+    unsigned long wait_ms = minutes * 60UL * 1000;
+    wait_ms += (long)(wait_ms / 100) * random(-RETRY_JITTER, RETRY_JITTER + 1);
+
+    Serial.printf("Failure %u in a row (%s), retrying in %lu s, radio on %lu ms this cycle\n",
+                  rtc_data.failures, policy.name, wait_ms / 1000, radio_on_ms);
+
+    retry_reason = reason;
+    retry_at = now_ms() + wait_ms;
+    retry_minutes_shown = -1;
+    show_retry_countdown();
+    set_fetch_state(FETCH_RETRY_WAIT);
+}
+
+
+// We end up here if we were unable to connect to wifi
+void connect_failed() {
+    int status = WiFi.status();   // Grab the connection error info
+    connect_ms += millis() - radio_wake_time;
+    radio_sleep();                // Put Wi-Fi back to sleep
+
+    // Tell the user we couldn't connect and display error message
+    display.clearDisplay();
+    display.setCursor(0, 0);
+    display.setTextSize(1);
+    display.println(" Failed to connect  ");
+    display.printf ("   after %d tries   \n", maxAttempts);
+    display.println("--------------------");
+    display.println("WiFi Status Report:");
+    display.println();
+    switch (status) {   // Display what the connection error code was
+        case WL_NO_SSID_AVAIL:    // The access point may be switched off, so keep trying (slowly)
+            schedule_retry(FAILURE_WIFI_NOT_FOUND);
+            break;
+        case WL_WRONG_PASSWORD:
+            display.println("Wrong password");
+            display.println("Check password");
+            flush_display();
+            halt_program_execution();
+            break;
+        case WL_DISCONNECTED:     // Fall through to the next case
+        case WL_CONNECT_FAILED:   // Fall through to the next case
+        case WL_CONNECTION_LOST:  // Fall through to the next case
+        default:                  // Wait (without blocking loop()) and then retry connecting
+            Serial.printf("Wi-Fi status code: %d\n", status);
+            schedule_retry(FAILURE_WIFI_LOST);
+            break;
+    }
+}
+
+
+// Keep the hourly forecast of a location, in the same compact form as the current weather
+void store_forecast(JsonObject hourly, int location){
+    JsonArray times = hourly["time"];
+    fetched.forecast_count = min((int)times.size(), FORECAST_HOURS);
+    if (fetched.forecast_count == 0) return;
+    fetched.forecast_start = times[0];
+
+    for (int i = 0; i < weather_field_count; i++) {
+        if (!field_is_needed(weather_fields[i])) continue;
+
+        int index = field_index(weather_fields[i]);
+        JsonArray values = hourly[weather_fields[i].name];
+        for (int hour = 0; hour < fetched.forecast_count; hour++) {
+            float value = values[hour];
+            sample_values(fetched.forecast[location][hour])[index] = lroundf(value * weather_fields[i].to_tenths);
+        }
+    }
+}
+
+
+// Estimate the weather at a (unix) time from the hourly forecast, going in a straight
+// line between the hours. Returns false if the forecast doesn't cover that time.
+bool estimate_from_forecast(uint32_t time, int location, WeatherSample& sample){
+    if (forecast_count < 2 || time < forecast_start) return false;
+
+    uint32_t offset = time - forecast_start;
+    int hour = offset / 3600;
+    if (hour >= forecast_count - 1) return false;   // Past the end of the forecast
+    long seconds = offset % 3600;
+
+    int16_t* before = sample_values(forecast[location][hour]);
+    int16_t* after = sample_values(forecast[location][hour + 1]);
+    int16_t* result = sample_values(sample);
+    for (int i = 0; i < 8; i++) {
+        result[i] = before[i] + (long)(after[i] - before[i]) * seconds / 3600;
+    }
+    return true;
+}
+
+
+// Move the displayed weather along the forecast (no Wi-Fi needed).
+// Returns false if it's time to fetch new data instead. While we wait to retry a
+// failed fetch, the forecast is used for as long as it lasts.
+bool update_from_forecast(){
+    unsigned long now = now_ms();
+    if (!USE_FORECAST) return false;
+    if (fetch_state != FETCH_RETRY_WAIT && now - last_fetch_time >= next_fetch_minutes * 60UL * 1000) return false;
+
+    uint32_t time = clock_now();
+    WeatherSample estimate;
+    for (int location = 0; location < LOCATION_COUNT; location++) {
+        if (!estimate_from_forecast(time, location, estimate)) return false;
+
+        // Keep the values that are not part of the forecast
+        for (int i = 0; i < weather_field_count; i++) {
+            if (!field_is_needed(weather_fields[i])) continue;
+            int index = field_index(weather_fields[i]);
+            sample_values(location_weather[location])[index] = sample_values(estimate)[index];
+        }
+    }
+    weather = location_weather[selected_location];
+
+    // Show the time of the estimate
+    set_formatted_time(time);
+
+    forecast_updates++;
+    save_weather_to_rtc();
+    add_to_history(time);
+    display_weather();
+    return true;
+}
+
+
+// Work out how long to wait before the next fetch, from how fast the weather changes
+// (measured since the last fetch, and predicted by the forecast), the time of day,
+// and the battery voltage
+void adapt_fetch_interval(){
+    if (!USE_ADAPTIVE_REFRESH) return;
+
+    // How fast are temperature and pressure changing (in tenths per hour)?
+    // With nothing to measure it from yet (the first fetch, and no forecast) we don't
+    // know, which is not the same as "stable": use the default interval.
+    long temp_change = 0;
+    long pressure_change = 0;
+    bool measured = false;
+    if (have_previous_fetch && api_time > previous_fetch_api_time) {
+        uint32_t seconds = api_time - previous_fetch_api_time;
+        temp_change = abs(location_weather[0].temp_c - previous_fetch.temp_c) * 3600L / seconds;
+        pressure_change = abs(location_weather[0].pressure_hpa - previous_fetch.pressure_hpa) * 3600L / seconds;
+        measured = true;
+    }
+    if (USE_FORECAST) {
+        const WeatherSample* home = forecast[0];
+        for (int hour = 1; hour < forecast_count; hour++) {
+            temp_change = max(temp_change, (long)abs(home[hour].temp_c - home[hour - 1].temp_c));
+            pressure_change = max(pressure_change, (long)abs(home[hour].pressure_hpa - home[hour - 1].pressure_hpa));
+            measured = true;
+        }
+    }
+    previous_fetch = location_weather[0];
+    previous_fetch_api_time = api_time;
+    have_previous_fetch = true;
+
+    // Look up the interval for this speed of change
+    fetch_interval_minutes = DEFAULT_FETCH_INTERVAL;
+    if (measured) {
+        for (const FetchIntervalStep& step : fetch_interval_steps) {
+            if (temp_change <= step.temp_change && pressure_change <= step.pressure_change) {
+                fetch_interval_minutes = step.minutes;
+                break;
+            }
+        }
+    }
+
+    // Fetch less often at night
+    int hour = (clock_now() + utcOffsetInSeconds) / 3600 % 24;
+    bool night = NIGHT_START_HOUR > NIGHT_END_HOUR ? (hour >= NIGHT_START_HOUR || hour < NIGHT_END_HOUR)
+                                                   : (hour >= NIGHT_START_HOUR && hour < NIGHT_END_HOUR);
+    unsigned long minutes = fetch_interval_minutes;
+    if (night) minutes *= 2;
+
+    // Save the battery when it is running low
+    uint16_t vcc = ESP.getVcc();
+    if (vcc < LOW_BATTERY_MV) {
+        minutes = MAX_FETCH_INTERVAL;
+    } else if (vcc < WEAK_BATTERY_MV) {
+        minutes *= 2;
+    }
+
+    fetch_interval_minutes = constrain(fetch_interval_minutes, MIN_FETCH_INTERVAL, MAX_FETCH_INTERVAL);
+    minutes = constrain(minutes, MIN_FETCH_INTERVAL, MAX_FETCH_INTERVAL);
+
+    // With a forecast, the display still changes at least every REFRESH_INTERVAL minutes,
+    // in equal steps that end exactly at the next fetch
+    unsigned long steps = USE_FORECAST ? (minutes + REFRESH_INTERVAL - 1) / REFRESH_INTERVAL : 1;
+    interval = minutes * 60 * 1000 / steps;
+    next_fetch_minutes = minutes;
+
+    Serial.printf("Next fetch in %lu minutes (temp %ld, pressure %ld tenths per hour, %u mV%s)\n",
+                  minutes, temp_change, pressure_change, vcc, night ? ", night" : "");
+}
+
+
+// Start reading a reply: the values it doesn't send stay as they are
+void start_fetched_weather(){
+    memcpy(fetched.current, location_weather, sizeof(fetched.current));
+    memcpy(fetched.forecast, forecast, sizeof(fetched.forecast));
+    fetched.forecast_count = forecast_count;
+    fetched.forecast_start = forecast_start;
+    fetched.api_time = api_time;
+    fetched.api_interval = api_interval;
+}
+
+
+// Keep the weather of one location from the response (in "fetched", until
+// use_fetched_weather())
+void store_location(JsonObject response, int location){
+    JsonObject current = response["current"];
+    for (int i = 0; i < weather_field_count; i++) {
+        if (field_is_needed(weather_fields[i])) {
+            // The only floating-point math: once per value, when it arrives
+            float value = current[weather_fields[i].name];
+            sample_values(fetched.current[location])[field_index(weather_fields[i])] =
+                lroundf(value * weather_fields[i].to_tenths);
+        }
+    }
+    if (location == 0) {
+        fetched.api_time = current["time"];
+        fetched.api_interval = current["interval"];   // 0 if the server didn't send it
+    }
+
+    if (USE_FORECAST) {
+        store_forecast(response["hourly"], location);
+    }
+}
+
+
+// Every location of the reply was read: show it from now on
+void use_fetched_weather(){
+    memcpy(location_weather, fetched.current, sizeof(location_weather));
+    memcpy(forecast, fetched.forecast, sizeof(forecast));
+    forecast_count = fetched.forecast_count;
+    forecast_start = fetched.forecast_start;
+    api_time = fetched.api_time;
+    api_interval = fetched.api_interval;
+}
+
+
+// Skip any spaces and return the next character of the body (without reading it),
+// or -1 at the end of the body
+int peek_next_char(BodyReader& body){
+    int c = body.peek();
+    while (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+        body.read();
+        c = body.peek();
+    }
+    return c;
+}
+
+
+// True if the server may have new data since our last fetch
+bool server_has_new_data(){
+    if (!USE_CONDITIONAL_FETCH || !clock_is_set || api_interval == 0) return true;
+    return clock_now() >= api_time + api_interval;
+}
+
+
+// Plan a fetch for just after the server's next update (SERVER_UPDATE_MARGIN seconds
+// later), instead of waiting for the timer to come around again
+void fetch_after_server_update(){
+    if (!USE_CONDITIONAL_FETCH || !clock_is_set || api_interval == 0) return;
+
+    uint32_t now = clock_now();
+    uint32_t next_update = api_time + api_interval;
+    if (next_update <= now) {   // Already passed (e.g. after "304 Not Modified"), so take the one after
+        next_update += ((now - next_update) / api_interval + 1) * api_interval;
+    }
+    update_fetch_at = now_ms() + (next_update + SERVER_UPDATE_MARGIN - now) * 1000UL;
+    update_fetch_pending = true;
+}
+
+
+// Remember a header of the reply (e.g. the ETag) for the next request
+void save_header(HTTPClient& http, const char* name, char* value, size_t size){
+    if (http.hasHeader(name)) {
+        strncpy(value, http.header(name).c_str(), size - 1);
+        value[size - 1] = '\0';
+    } else {
+        value[0] = '\0';
+    }
+}
+
+
+// Get the time from NTP (only when the weather server didn't give us the time)
+void sync_time_with_ntp() {
+    unsigned long phase_start = millis();
+    bool synced = timeClient.update();
+    time_sync_ms = millis() - phase_start;
+    ntp_syncs++;
+
+    if (synced) {
+        set_clock(timeClient.getEpochTime() - utcOffsetInSeconds);
+    } else if (!clock_is_set) {
+        set_clock(api_time);   // Better than nothing: the start of the API's current interval
+    }
+    set_formatted_time(clock_now());
+    save_weather_to_rtc();
+    display_weather();
+}
+
+
+// Function to Fetch and Display the Weather Data
+// Returns FAILURE_NONE if it worked, otherwise what went wrong
+FailureKind fetch_and_display_weather() {
+    WiFiClientSecure secure_client;
+    WiFiClient plain_client;
+    if (strlen(server_fingerprint) > 0) {
+        secure_client.setFingerprint(server_fingerprint);   // Only accept the server's own certificate
+    } else {
+        secure_client.setInsecure(); // Accept all certificates for convenience
+    }
+    secure_client.setSession(&tls_session);   // Resume the last TLS session (if there is one)
+    tls_session_offered = USE_HTTPS && rtc_data.has_tls_session;
+    WiFiClient& client = USE_HTTPS ? secure_client : plain_client;
+    HTTPClient http;
+
+    display_message(" Fetching WX Data...", user_selected_text_size, 0);
+
+    // Ask for HTTP/1.0 so the server normally does not send a "chunked" body
+    // (BodyReader can read one anyway)
+    http.useHTTP10(true);
+    http.setTimeout(HTTP_TIMEOUT);
+
+    // Keep the Date header, so we can set the clock without asking NTP,
+    // and the Transfer-Encoding header, to know if the body is chunked
+    const char* header_names[] = { "Date", "Transfer-Encoding", "ETag", "Last-Modified" };
+    http.collectHeaders(header_names, 4);
+
+    FailureKind result = FAILURE_CONNECTION;
+    tls_request_ms = 0;
+    unsigned long phase_start = millis();
+    if (http.begin(client, server_host, SERVER_PORT, server_path)) {
+        // Let the server answer "Not Modified" if we already have its latest data
+        if (USE_CONDITIONAL_FETCH && rtc_data.etag[0] != '\0') {
+            http.addHeader("If-None-Match", rtc_data.etag);
+        }
+        if (USE_CONDITIONAL_FETCH && rtc_data.last_modified[0] != '\0') {
+            http.addHeader("If-Modified-Since", rtc_data.last_modified);
+        }
+
+        unsigned long request_start = millis();
+        int httpCode = http.GET();
+        tls_request_ms = millis() - request_start;
+        if (httpCode > 0) {
+            if (USE_HTTPS) {
+                save_tls_session_to_rtc();   // The handshake worked, so keep the session for next time
+            }
+
+            uint32_t server_time;
+            if (parse_http_date(http.header("Date").c_str(), server_time)) {
+                set_clock(server_time);
+            }
+
+            if (httpCode == HTTP_CODE_OK) {
+                // Only keep the "current" values we actually use.
+                // Everything else is skipped while it is being read.
+                StaticJsonDocument<FILTER_DOCUMENT_SIZE> filter;
+                JsonObject current_filter = filter.createNestedObject("current");
+                JsonObject hourly_filter = filter.createNestedObject("hourly");
+                current_filter["time"] = true;
+                current_filter["interval"] = true;
+                hourly_filter["time"] = true;
+                for (int i = 0; i < weather_field_count; i++) {
+                    if (field_is_needed(weather_fields[i])) {
+                        current_filter[weather_fields[i].name] = true;
+                        hourly_filter[weather_fields[i].name] = true;
+                    }
+                }
+                if (filter.overflowed()) {
+                    // A value missing from the filter would silently read as 0, so stop here
+                    Serial.printf("JSON filter needs more than %u bytes\n", (unsigned int)filter.capacity());
+                    display_message("  JSON filter is\n    too small!", 1, 0);
+                    halt_program_execution();
+                }
+
+                // Parse straight from the network stream (no String copy of the body).
+                // With more than one location the body is a list with one object per
+                // location. They are read one at a time, so the JSON document only ever
+                // has to hold one location.
+                BodyReader stream(http.getStream(), http.header("Transfer-Encoding").equalsIgnoreCase("chunked"));
+                StaticJsonDocument<JSON_DOCUMENT_SIZE> doc;
+                bool is_list = peek_next_char(stream) == '[';
+                if (is_list) stream.read();
+
+                int locations_read = 0;
+                json_memory_used = 0;
+                start_fetched_weather();
+                while (locations_read < LOCATION_COUNT) {
+                    size_t location_start = stream.bytesRead();
+                    unsigned long parse_start = micros();
+                    DeserializationError error = deserializeJson(doc, stream, DeserializationOption::Filter(filter));
+                    if (error) {
+                        Serial.printf("JSON error: %s\n", error.c_str());
+                        break;
+                    }
+                    store_location(doc.as<JsonObject>(), locations_read);
+                    json_memory_used = max(json_memory_used, doc.memoryUsage());
+
+                    Serial.printf("Location %d (%s): %u bytes, read and parsed in %lu us\n",
+                                  locations_read, locations[locations_read].name,
+                                  (unsigned int)(stream.bytesRead() - location_start), micros() - parse_start);
+                    locations_read++;
+
+                    // Move on to the next object of the list (skipping the comma)
+                    if (!is_list || peek_next_char(stream) != ',') break;
+                    stream.read();
+                }
+
+                // Anything after the last location (just the end of the list) is never read
+                bytes_parsed = stream.bytesRead();
+                first_byte_ms = tls_request_ms + stream.firstByteTime();
+                body_stop_reason = stream.stopReason();
+                sample_heap();   // The TLS buffers are still in use here, so this is the low point
+                Serial.printf("JSON memory used %u of %u bytes\n",
+                              (unsigned int)json_memory_used, (unsigned int)doc.capacity());
+
+                if (locations_read == LOCATION_COUNT) {
+                    use_fetched_weather();
+                    weather = location_weather[selected_location];
+                    last_fetch_time = cycle_start;   // The planned time, so the next fetch is on time too
+                    set_formatted_time(clock_is_set ? clock_now() : api_time);
+                    adapt_fetch_interval();
+
+                    save_header(http, "ETag", rtc_data.etag, sizeof(rtc_data.etag));   // Saved to RTC memory below
+                    save_header(http, "Last-Modified", rtc_data.last_modified, sizeof(rtc_data.last_modified));
+                    full_fetches++;
+
+                    rtc_data.failures = 0;   // Saved to RTC memory with the weather
+                    save_weather_to_rtc();
+                    add_to_history(clock_is_set ? clock_now() : api_time);
+                    display_weather();
+                    result = FAILURE_NONE;
+                } else {
+                    result = FAILURE_DATA;
+                }
+            } else if (httpCode == HTTP_CODE_NOT_MODIFIED) {
+                // Nothing new: keep what we have, and try again after the next server update
+                last_fetch_time = cycle_start;
+                fetch_after_server_update();
+                not_modified_fetches++;
+                if (rtc_data.failures != 0) {
+                    rtc_data.failures = 0;
+                    save_rtc_data();
+                }
+                display_weather();
+                result = FAILURE_NONE;
+            } else if (httpCode == 429 || httpCode >= 500) {
+                Serial.printf("HTTP code %d\n", httpCode);
+                result = FAILURE_SERVER;
+            } else {
+                Serial.printf("HTTP code %d\n", httpCode);
+                result = FAILURE_REQUEST;
+            }
+        }
+        http.end();
+    }
+    http_ms = millis() - phase_start;
+
+    // One line per fetch, whatever happened, so the Serial log shows how long each kind of result takes
+    Serial.printf("Fetch result: %s after %lu ms (headers after %lu ms)\n",
+                  retry_policies[result].name, http_ms, tls_request_ms);
+    if (result == FAILURE_NONE || result == FAILURE_DATA) {
+        Serial.printf("Body: %u bytes, first byte after %lu ms, %s\n",
+                      (unsigned int)bytes_parsed, first_byte_ms, body_stop_reason);
+    }
+    return result;
+}
+
+
+// Start a complete update: connect, fetch and display the weather, then sleep the Wi-Fi.
+// The work itself is done by run_fetch_step().
+void start_fetch_cycle() {
+    update_fetch_pending = false;   // This fetch replaces any planned one
+    cycle_start = now_ms();
+    previousMillis = cycle_start;   // The display and fetch timer count from here
+    radio_on_ms = 0;
+    connect_ms = 0;
+    time_sync_ms = 0;
+    http_ms = 0;
+    set_fetch_state(FETCH_START);
+}
+
+
+// The fetch cycle worked: sleep the Wi-Fi and report how it went
+void finish_fetch_cycle() {
+    radio_sleep();   // Put the Wi-Fi module back to sleep
+    set_fetch_state(FETCH_IDLE);
+
+    cycle_time_ms = now_ms() - cycle_start;
+    fetch_cycles++;
+    sample_heap();
+    print_cycle_stats();
+    max_loop_ms = 0;
+}
+
+
+// Do the next step of the fetch cycle. Each step returns quickly, except for the
+// time and weather requests, which are limited by their own timeouts.
+void run_fetch_step() {
+    unsigned long state_time = millis() - state_start;
+
+    switch (fetch_state) {
+        case FETCH_IDLE:
+            break;
+
+        case FETCH_START:
+            start_connecting();
+            break;
+
+        case FETCH_QUICK_CONNECT:
+            if (WiFi.status() == WL_CONNECTED) {
+                set_fetch_state(FETCH_SETTLE);
+            } else if (state_time >= FAST_CONNECT_TIMEOUT) {
+                forget_saved_access_point();
+                set_fetch_state(FETCH_CONNECT);
+            }
+            break;
+
+        case FETCH_CONNECT:
+            if (connect_attempt < maxAttempts) {
+                start_connect_attempt();
+            } else {
+                connect_failed();
+            }
+            break;
+
+        case FETCH_CONNECTING:
+            if (WiFi.status() == WL_CONNECTED) {
+                save_wifi_to_rtc();    // Remember this access point for a quick connect next time
+                set_fetch_state(FETCH_SETTLE);
+            } else if (state_time >= CONNECT_TIMEOUT) {
+                set_fetch_state(FETCH_CONNECT);   // Try again (or give up)
+            } else if (millis() - last_dot_time >= 500 && showing_status) {
+                last_dot_time = millis();
+                display.printf(".");
+                flush_display();
+            }
+            break;
+
+        case FETCH_SETTLE:
+            // Give the network stack a little time to finish connecting
+            if (state_time >= 500) {
+                connect_ms += millis() - radio_wake_time;
+                set_fetch_state(FETCH_WEATHER);
+            }
+            break;
+
+        case FETCH_WEATHER: {
+            FailureKind result = fetch_and_display_weather();
+            if (result != FAILURE_NONE) {
+                radio_sleep();   // Put the Wi-Fi module back to sleep
+                schedule_retry(result);
+            } else if (clock_needs_ntp()) {
+                set_fetch_state(FETCH_TIME);   // No Date header, and the clock may be off
+            } else {
+                finish_fetch_cycle();
+            }
+            break;
+        }
+
+        case FETCH_TIME:
+            sync_time_with_ntp();
+            finish_fetch_cycle();
+            break;
+
+        case FETCH_RETRY_WAIT:
+            if ((long)(now_ms() - retry_at) >= 0) {
+                set_fetch_state(FETCH_START);
+            } else if (showing_status) {
+                show_retry_countdown();
+            }
+            break;
+    }
+}
+
+
+void setup() {
+    // Serial is only used to report fetch statistics
+    Serial.begin(115200);
+
+    // Use the hardware random number generator for the retry jitter
+    randomSeed(ESP.random());
+
+    // Configure the GPIO pin (Flash button) as an input
+    pinMode(buttonPin, INPUT_PULLUP);
+
+    // Initialize I2C (display) communication on the correct pins
+    Wire.begin(OLED_SDA, OLED_SCL);
+    Wire.setClock(I2C_CLOCK);
+
+    // Initialize the OLED display with the correct address
+    // If initialization fails, the program halts
+    if(!display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS)) {
+        for(;;);
+    }
+    display.buildGlyphCache();
+    build_layout_screens();
+
+    // Work out which weather values to ask for
+    build_server_path();
+
+    // Don't let the Wi-Fi library write the connection settings to flash every time
+    WiFi.persistent(false);
+
+    // Print a boot message (mostly to clear the screen)
+    display_message("     WX Display\n       by Jds", 1, 2);
+
+    // If we have a saved weather reading (e.g. after a reset), show it right away
+    load_rtc_data();
+    if (rtc_data.has_weather) {
+        display_weather();
+    }
+
+    // Our initial try to connect and fetch the weather information
+    // The fetch itself, and the repeats, are handled by loop()
+    start_fetch_cycle();
+}
+
+
+void loop() {
+    unsigned long loop_start = millis();
+    unsigned long currentMillis = now_ms();
+
+    // If it's time for an update (based on timer), connect and fetch data again
+    // (unless we are still busy with the last fetch)
+    if (currentMillis - previousMillis >= interval) {   // Time is up
+        previousMillis = currentMillis;   // Reset the timer
+
+        // Use the forecast if we have one, otherwise fetch new data
+        // (if the server can have any yet). While waiting to retry, the retry
+        // comes at its own time, but the display still moves along the forecast.
+        if (fetch_state == FETCH_RETRY_WAIT) {
+            if (!update_from_forecast() && !showing_status) {
+                retry_minutes_shown = -1;   // The forecast ran out: show the countdown again
+                show_retry_countdown();
+            }
+        } else if (fetch_state == FETCH_IDLE && !update_from_forecast()) {
+            if (server_has_new_data()) {
+                start_fetch_cycle();
+            } else {
+                skipped_fetches++;
+                Serial.printf("Fetch skipped, the server has no new data until %lu s from now\n",
+                              (unsigned long)(api_time + api_interval - clock_now()));
+                fetch_after_server_update();
+            }
+        }
+    }
+
+    // Do a fetch that was waiting for the server's next update
+    if (update_fetch_pending && fetch_state == FETCH_IDLE && (long)(currentMillis - update_fetch_at) >= 0) {
+        start_fetch_cycle();
+    }
+
+    // Do the next step of the fetch cycle (if there is one)
+    run_fetch_step();
+
+    // Read button state
+    int buttonState = digitalRead(buttonPin);
+    unsigned long currentTime = now_ms();
+
+    // Check for a button press (LOW state) and debounce it
+    if (buttonState == LOW && (currentTime - lastPressTime) > debounceDelay) {
+        // The button has been pressed and it's not a bounce
+        lastPressTime = currentTime;
+
+        // Go to the next screen: normal text and large text for each location,
+        // then the history graphs, and around again
+        if (showing_history) {                       // If showing the graphs, go back to size 1
+            showing_history = false;
+            user_selected_text_size = 1;
+        } else if (user_selected_text_size == 1) {   // If currently size 1, set to 2
+            user_selected_text_size = 2;
+        } else if (selected_location < LOCATION_COUNT - 1) {   // If size 2, go to the next location
+            selected_location++;
+            user_selected_text_size = 1;
+        } else {                                     // If size 2 of the last location, show the graphs
+            showing_history = true;
+            selected_location = 0;                   // (The graphs are of the home location)
+        }
+        weather = location_weather[selected_location];
+
+        // Display the weather data on the new screen
+        display_weather();
+    }
+
+    // Keep track of how long loop() takes, to make sure the button never has to wait long
+    unsigned long loop_ms = millis() - loop_start;
+    if (loop_ms > max_loop_ms) max_loop_ms = loop_ms;
+
+    // Sleep until the next fetch or retry (or a button press), unless the button is still
+    // held down or we are in the middle of a fetch
+    if (fetch_state != FETCH_IDLE && fetch_state != FETCH_RETRY_WAIT) {
+        delay(10);   // Let the Wi-Fi stack run while we wait for it
+    } else if (USE_LIGHT_SLEEP && digitalRead(buttonPin) == HIGH) {
+        unsigned long elapsed = now_ms() - previousMillis;
+        if (elapsed < interval) {
+            unsigned long sleep_ms = interval - elapsed;
+            if (fetch_state == FETCH_RETRY_WAIT) {
+                // Wake up in time for the retry, and whenever the countdown changes
+                long until_retry = retry_at - now_ms();
+                long until_next_minute = until_retry > 0 ? (until_retry - 1) % 60000 + 1 : 0;
+                sleep_ms = min(sleep_ms, (unsigned long)until_next_minute);
+            }
+            if (update_fetch_pending) {
+                // Wake up in time for the fetch after the server's next update
+                long until_fetch = update_fetch_at - now_ms();
+                sleep_ms = min(sleep_ms, (unsigned long)max(until_fetch, 0L));
+            }
+            light_sleep(sleep_ms);
+        }
+    }
+}